@@ -17,7 +17,7 @@ string cnvToHexStr(Byte b)
 	return stream.str();
 }
 
-string cnvToHexStr(ByteString s)
+string cnvToHexStr(ByteView s)
 {
 	std::ostringstream stream;
 	for (auto i : s)
@@ -76,7 +76,7 @@ string cnvToBinStr(string s)
 	return r;
 }
 
-string cnvToAsciiStr(ByteString s)
+string cnvToAsciiStr(ByteView s)
 {
 	return string(reinterpret_cast<const char*>(s.data()), s.length());
 }
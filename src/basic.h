@@ -2,7 +2,9 @@
 #define BASIC_H
 
 #include <chrono>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <iostream> 
 #include <sstream> 
 
@@ -12,6 +14,7 @@ using std::endl;
 
 typedef unsigned char Byte;
 typedef std::basic_string<Byte> ByteString;
+typedef std::basic_string_view<Byte> ByteView;
 
 //template<typename T>
 //string cnvToHexStr(T v)
@@ -29,14 +32,35 @@ string cnvToStr(T v)
 	return stream.str();
 }
 
+// Immutable reference counted string. Copies share the same character buffer, so a payload
+// is written into memory once and then passed between handlers, events and links for free.
+class SharedString
+{
+private:
+	std::shared_ptr<const string> str;
+	inline static const string empty;
+
+public:
+	SharedString() = default;
+	SharedString(string s) : str(std::make_shared<const string>(std::move(s))) {}
+	SharedString(const char* data, std::size_t length) : str(std::make_shared<const string>(data, length)) {}
+
+	const string& get() const { return str ? *str : empty; }
+	operator const string&() const { return get(); }
+
+	bool operator==(const SharedString& x) const { return str == x.str || get() == x.get(); }
+};
+
+inline std::ostream& operator<<(std::ostream& stream, const SharedString& s) { return stream << s.get(); }
+
 extern string cnvToHexStr(Byte b);
-extern string cnvToHexStr(ByteString s);
+extern string cnvToHexStr(ByteView s);
 extern string cnvToHexStr(string s);
 extern string cnvFromHexStr(string s);
 
 extern string cnvToBinStr(string s);
 
-extern string cnvToAsciiStr(ByteString s);
+extern string cnvToAsciiStr(ByteView s);
 extern ByteString cnvFromAsciiStr(string s);
 
 using Seconds = std::chrono::seconds;
@@ -13,6 +13,7 @@
 #include "http.h"
 #include "tcp.h"
 #include "modbus.h"
+#include "httpserver.h"
 #include "storage.h"
 #include "finally.h"
 
@@ -329,6 +330,14 @@ Links Config::getLinks(const Items& items, Log& log) const
 		bool suppressReadEvents = getBool(linkValue, "suppressReadEvents", false);
 		string operationalItemId = getString(linkValue, "operationalItemId", "");
 		string errorCounterItemId = getString(linkValue, "errorCounterItemId", "");
+		std::map<string, ItemId> metricItemIds;
+		if (hasMember(linkValue, "metricItemIds"))
+			for (auto& member : getObject(linkValue, "metricItemIds").GetObject())
+			{
+				if (!member.value.IsString())
+					throw std::runtime_error("Field " + string(member.name.GetString()) + " in metricItemIds is not a string");
+				metricItemIds[member.name.GetString()] = member.value.GetString();
+			}
 		int maxReceiveDuration = getInt(linkValue, "maxReceiveDuration", 20);
 		int maxSendDuration = getInt(linkValue, "maxSendDuration", 20);
 
@@ -436,6 +445,8 @@ Links Config::getLinks(const Items& items, Log& log) const
 			handler.reset(new PortHandler(id, getPortConfig(getObject(linkValue, "port")), logger));
 		else if (hasMember(linkValue, "http"))
 			handler.reset(new HttpHandler(id, getHttpConfig(getObject(linkValue, "http")), logger));
+		else if (hasMember(linkValue, "httpServer"))
+			handler.reset(new httpserver::Handler(id, getHttpServerConfig(getObject(linkValue, "httpServer")), logger));
 		else if (hasMember(linkValue, "tcp"))
 			handler.reset(new TcpHandler(id, getTcpConfig(getObject(linkValue, "tcp")), logger));
 		else if (hasMember(linkValue, "modbus"))
@@ -451,7 +462,7 @@ Links Config::getLinks(const Items& items, Log& log) const
 		else
 			throw std::runtime_error("Link " + id + " with unknown or missing type in configuration");
 
-		links.add(Link(id, enabled, suppressReadEvents, operationalItemId, errorCounterItemId,
+		links.add(Link(id, enabled, suppressReadEvents, operationalItemId, errorCounterItemId, metricItemIds,
 			maxReceiveDuration, maxSendDuration, numberAsString,
 			booleanAsString, falseValue, trueValue, unwritableFalseValue, unwritableTrueValue,
 			timePointAsString, timePointFormat, voidAsString, voidValue, unwritableVoidValue,
@@ -480,13 +491,31 @@ mqtt::Config Config::getMqttConfig(const rapidjson::Value& value) const
 
 	int reconnectInterval = getInt(value, "reconnectInterval", 60);
 	int idleTimeout = getInt(value, "idleTimeout", 0);
+	int maxQueuedMsgs = getInt(value, "maxQueuedMsgs", 1000);
+	if (maxQueuedMsgs < 1)
+		throw std::runtime_error("Invalid value " + cnvToStr(maxQueuedMsgs) + " for field maxQueuedMsgs in configuration");
+	mqtt::Config::DropPolicy dropPolicy;
+	if (string str = getString(value, "queueDropPolicy", "oldest"); str == "oldest")
+		dropPolicy = mqtt::Config::DROP_OLDEST;
+	else if (str == "newest")
+		dropPolicy = mqtt::Config::DROP_NEWEST;
+	else
+		throw std::runtime_error("Invalid value " + str + " for field queueDropPolicy in configuration");
+	int flushBatchSize = getInt(value, "flushBatchSize", 100);
+	if (flushBatchSize < 1)
+		throw std::runtime_error("Invalid value " + cnvToStr(flushBatchSize) + " for field flushBatchSize in configuration");
 
 	string username = getString(value, "username", "");
 	string password = getString(value, "password", "");
 	bool retainFlag = getBool(value, "retainFlag", true);
 
 	string topicPrefix = getString(value, "topicPrefix", "");
-	auto addPrefix = [&](string topic){ return topicPrefix + topic; };
+	auto addPrefix = [&](string topic)
+	{
+		// the prefix belongs behind $share/<group>/ of a shared subscription
+		string filter = mqtt::TopicTree::getFilter(topic);
+		return topic.substr(0, topic.length() - filter.length()) + topicPrefix + filter;
+	};
 
 	auto getTopicPattern = [&](string name)
 	{
@@ -508,6 +537,17 @@ mqtt::Config Config::getMqttConfig(const rapidjson::Value& value) const
 	mqtt::Config::Topics subTopics = getStrings(value, "subTopic", {}, addPrefix);
 	bool logMsgs = getBool(value, "logMessages", false);
 	bool logLibEvents = getBool(value, "logLibEvents", false);
+	bool threadedLoop = getBool(value, "threadedLoop", false);
+	bool mqtt5;
+	if (string str = getString(value, "protocolVersion", "3.1.1"); str == "3.1.1")
+		mqtt5 = false;
+	else if (str == "5")
+		mqtt5 = true;
+	else
+		throw std::runtime_error("Invalid value " + str + " for field protocolVersion in configuration");
+	int msgExpiryInterval = getInt(value, "msgExpiryInterval", 0);
+	bool warmStart = getBool(value, "warmStart", false);
+	int warmStartTimeout = getInt(value, "warmStartTimeout", 10);
 
 	mqtt::Config::Bindings bindings;
 	if (hasMember(value, "bindings"))
@@ -518,15 +558,17 @@ mqtt::Config Config::getMqttConfig(const rapidjson::Value& value) const
 			string readTopic = getString(bindingValue, "readTopic", "", addPrefix);
 
 			std::regex msgPattern = getRegEx(bindingValue, "msgPattern", "^(.*)$");
+			bool anyMsg = getString(bindingValue, "msgPattern", "^(.*)$") == "^(.*)$";
 
 			for (string itemId : getStrings(bindingValue, "itemId"))
-				bindings.add(mqtt::Config::Binding(itemId, stateTopics, writeTopic, readTopic, msgPattern));
+				bindings.add(mqtt::Config::Binding(itemId, stateTopics, writeTopic, readTopic, msgPattern, anyMsg));
 		}
 
 	return mqtt::Config(clientId, hostname, port, tlsFlag, caFile, caPath, ciphers,
-			reconnectInterval, idleTimeout, username, password, retainFlag, inStateTopicPattern,
+			reconnectInterval, idleTimeout, maxQueuedMsgs, dropPolicy, flushBatchSize, username, password, retainFlag, inStateTopicPattern,
 			inWriteTopicPattern, inReadTopicPattern, outStateTopicPattern, outWriteTopicPattern,
-			outReadTopicPattern, subTopics, logMsgs, logLibEvents, bindings);
+			outReadTopicPattern, subTopics, logMsgs, logLibEvents, threadedLoop,
+			mqtt5, msgExpiryInterval, warmStart, warmStartTimeout, bindings);
 }
 
 KnxConfig Config::getKnxConfig(const rapidjson::Value& value) const
@@ -537,16 +579,37 @@ KnxConfig Config::getKnxConfig(const rapidjson::Value& value) const
 
 	bool natMode = getBool(value, "natMode", false);
 
-	IpAddr ipAddr;
-	if (string str = getString(value, "ipAddr"); !IpAddr::fromStr(str, ipAddr))
-		throw std::runtime_error("Invalid value " + str + " for field ipAddr in configuration");
-	IpPort ipPort = getInt(value, "ipPort", 3671);
+	auto getTunnels = [](const rapidjson::Value& value, KnxConfig::Tunnels& tunnels, int count)
+	{
+		IpAddr ipAddr;
+		if (string str = getString(value, "ipAddr"); !IpAddr::fromStr(str, ipAddr))
+			throw std::runtime_error("Invalid value " + str + " for field ipAddr in configuration");
+		IpPort ipPort = getInt(value, "ipPort", 3671);
+		if (count < 1)
+			throw std::runtime_error("Invalid number " + cnvToStr(count) + " of tunnels in configuration");
+		for (int i = 0; i < count; i++)
+			tunnels.emplace_back(ipAddr, ipPort);
+	};
+	KnxConfig::Tunnels tunnels;
+	if (hasMember(value, "tunnels"))
+		for (auto& tunnelValue : getArray(value, "tunnels").GetArray())
+			getTunnels(tunnelValue, tunnels, getInt(tunnelValue, "count", 1));
+	else
+		getTunnels(value, tunnels, getInt(value, "tunnelCount", 1));
+	if (tunnels.size() < 1 || tunnels.size() > 32)
+		throw std::runtime_error("Invalid number " + cnvToStr(tunnels.size()) + " of tunnels in configuration");
 
 	Seconds reconnectInterval(getInt(value, "reconnectInterval", 60));
 	Seconds connStateReqInterval(getInt(value, "connStateReqInterval", 60));
 	Seconds controlRespTimeout(getInt(value, "controlRespTimeout", 10));
 	Seconds tunnelAckTimeout(getInt(value, "tunnelAckTimeout", 1));
 	Seconds ldataConTimeout(getInt(value, "ldataConTimeout", 3));
+	int readResponseWindow = getInt(value, "readResponseWindow", 5);
+	if (readResponseWindow < 1)
+		throw std::runtime_error("Invalid value " + cnvToStr(readResponseWindow) + " for field readResponseWindow in configuration");
+	int maxBusLoad = getInt(value, "maxBusLoad", 60);
+	if (maxBusLoad < 1 || maxBusLoad > 100)
+		throw std::runtime_error("Invalid value " + cnvToStr(maxBusLoad) + " for field maxBusLoad in configuration");
 
 	PhysicalAddr physicalAddr;
 	if (string str = getString(value, "physicalAddr", "0.0.0"); !PhysicalAddr::fromStr(str, physicalAddr))
@@ -573,9 +636,9 @@ KnxConfig Config::getKnxConfig(const rapidjson::Value& value) const
 		bindings.add(KnxConfig::Binding(getString(bindingValue, "itemId"), stateGa, writeGa, dpt));
 	}
 
-	return KnxConfig(localIpAddr, natMode, ipAddr, ipPort, reconnectInterval,
+	return KnxConfig(localIpAddr, natMode, tunnels, reconnectInterval,
 			connStateReqInterval, controlRespTimeout, tunnelAckTimeout,
-			ldataConTimeout, physicalAddr, logRawMsg, logData, bindings);
+			ldataConTimeout, Seconds(readResponseWindow), maxBusLoad, physicalAddr, logRawMsg, logData, bindings);
 }
 
 PortConfig Config::getPortConfig(const rapidjson::Value& value) const
@@ -684,23 +747,109 @@ HttpConfig Config::getHttpConfig(const rapidjson::Value& value) const
 	bool logTransfers = getBool(value, "logTransfers", false);
 	bool verboseMode = getBool(value, "verboseMode", false);
 
+	int maxConnectionAge = getInt(value, "maxConnectionAge", 300);
+	if (maxConnectionAge < 1)
+		throw std::runtime_error("Invalid value " + cnvToStr(maxConnectionAge) + " for field maxConnectionAge in configuration");
+	bool suppressUnchanged = getBool(value, "suppressUnchanged", false);
+
 	string dfltUrl = getString(value, "url", "");
 	auto dfltHeaders = getStrings(value, "header", {}, identity);
 
+	// resources whose transfers are shared by several bindings
+	struct Resource
+	{
+		string url;
+		std::unordered_set<string> headers;
+		string request;
+	};
+	std::map<string, Resource> resources;
+	if (hasMember(value, "resources"))
+		for (auto& resourceValue : getArray(value, "resources").GetArray())
+		{
+			string resourceId = getString(resourceValue, "id");
+			if (resources.count(resourceId))
+				throw std::runtime_error("Invalid value " + resourceId + " for field id in configuration");
+			resources[resourceId] = {getString(resourceValue, "url"), getStrings(resourceValue, "header", dfltHeaders), getString(resourceValue, "request", "")};
+		}
+
 	HttpConfig::Bindings bindings;
 	for (auto& bindingValue : getArray(value, "bindings").GetArray())
 	{
-		string url = hasMember(bindingValue, "url") ? getString(bindingValue, "url") : dfltUrl;
-		auto headers = getStrings(bindingValue, "header", dfltHeaders);
-
-		string request = getString(bindingValue, "request", "");
+		string resourceId = getString(bindingValue, "resourceId", "");
+		string url, request;
+		std::unordered_set<string> headers;
+		if (resourceId != "")
+		{
+			auto resourcePos = resources.find(resourceId);
+			if (resourcePos == resources.end())
+				throw std::runtime_error("Invalid value " + resourceId + " for field resourceId in configuration");
+			url = resourcePos->second.url;
+			headers = resourcePos->second.headers;
+			request = resourcePos->second.request;
+		}
+		else
+		{
+			url = hasMember(bindingValue, "url") ? getString(bindingValue, "url") : dfltUrl;
+			headers = getStrings(bindingValue, "header", dfltHeaders);
+			request = getString(bindingValue, "request", "");
+		}
 		std::regex responsePattern = getRegEx(bindingValue, "responsePattern");
 
 		for (string itemId : getStrings(bindingValue, "itemId"))
-			bindings.add(HttpConfig::Binding(itemId, url, headers, request, responsePattern));
+			bindings.add(HttpConfig::Binding(itemId, resourceId, url, headers, request, responsePattern));
+	}
+
+	return HttpConfig(user, password, logTransfers, verboseMode, Seconds(maxConnectionAge), suppressUnchanged, bindings);
+}
+
+httpserver::Config Config::getHttpServerConfig(const rapidjson::Value& value) const
+{
+	IpAddr localIpAddr;
+	if (string str = getString(value, "localIpAddr", "0.0.0.0"); !IpAddr::fromStr(str, localIpAddr))
+		throw std::runtime_error("Invalid value " + str + " for field localIpAddr in configuration");
+	int port = getInt(value, "port");
+
+	int maxConnections = getInt(value, "maxConnections", 16);
+	if (maxConnections < 1)
+		throw std::runtime_error("Invalid value " + cnvToStr(maxConnections) + " for field maxConnections in configuration");
+	int idleTimeout = getInt(value, "idleTimeout", 60);
+	if (idleTimeout <= 0)
+		throw std::runtime_error("Invalid value " + cnvToStr(idleTimeout) + " for field idleTimeout in configuration");
+	int maxRequestSize = getInt(value, "maxRequestSize", 65536);
+	if (maxRequestSize <= 0)
+		throw std::runtime_error("Invalid value " + cnvToStr(maxRequestSize) + " for field maxRequestSize in configuration");
+	Seconds reopenInterval(getInt(value, "reopenInterval", 60));
+
+	bool logRequests = getBool(value, "logRequests", false);
+
+	httpserver::Config::Bindings bindings;
+	for (auto& bindingValue : getArray(value, "bindings").GetArray())
+	{
+		string path = getString(bindingValue, "path");
+		string method = getString(bindingValue, "method", "");
+
+		EventType eventType;
+		string eventTypeStr = getString(bindingValue, "eventType", "STATE_IND");
+		if (!EventType::fromStr(eventTypeStr, eventType) || eventType == EventType::READ_REQ)
+			throw std::runtime_error("Invalid value " + eventTypeStr + " for field eventType in configuration");
+
+		bool fromQuery;
+		string sourceStr = getString(bindingValue, "source", "body");
+		if (sourceStr == "body")
+			fromQuery = false;
+		else if (sourceStr == "query")
+			fromQuery = true;
+		else
+			throw std::runtime_error("Invalid value " + sourceStr + " for field source in configuration");
+
+		bool hasPattern = hasMember(bindingValue, "pattern");
+		std::regex pattern = hasPattern ? getRegEx(bindingValue, "pattern") : std::regex();
+
+		for (string itemId : getStrings(bindingValue, "itemId"))
+			bindings.add(httpserver::Config::Binding(itemId, path, method, eventType, fromQuery, hasPattern, pattern));
 	}
 
-	return HttpConfig(user, password, logTransfers, verboseMode, bindings);
+	return httpserver::Config(localIpAddr, port, maxConnections, Seconds(idleTimeout), maxRequestSize, reopenInterval, logRequests, bindings);
 }
 
 TcpConfig Config::getTcpConfig(const rapidjson::Value& value) const
@@ -717,6 +866,7 @@ TcpConfig Config::getTcpConfig(const rapidjson::Value& value) const
 
 	int timeoutInterval = getInt(value, "timeoutInterval", 0);
 	int reconnectInterval = getInt(value, "reconnectInterval", 60);
+	Seconds connectTimeout(getInt(value, "connectTimeout", 10));
 
 	TcpConfig::Bindings bindings;
 	for (auto& bindingValue : getArray(value, "bindings").GetArray())
@@ -728,33 +878,110 @@ TcpConfig Config::getTcpConfig(const rapidjson::Value& value) const
 			bindings.add(TcpConfig::Binding(itemId, pattern, binMatching));
 	}
 
-	return TcpConfig(hostname, port, timeoutInterval, reconnectInterval, convertToHex,
+	return TcpConfig(hostname, port, timeoutInterval, reconnectInterval, connectTimeout, convertToHex,
 			msgPattern, maxMsgSize, logRawData, bindings);
 }
 
 modbus::Config Config::getModbusConfig(const rapidjson::Value& value) const
 {
-	string hostname = getString(value, "hostname");
-	int port = getInt(value, "port", 502);
+	modbus::Config::SerialPort serialPort;
+	if (hasMember(value, "serialPort"))
+	{
+		auto& portValue = getObject(value, "serialPort");
+
+		string name = getString(portValue, "name");
+
+		int baudRate = getInt(portValue, "baudRate", 9600);
+		if (!PortConfig::isValidBaudRate(baudRate))
+			throw std::runtime_error("Invalid value for field baudRate in configuration");
+
+		int dataBits = getInt(portValue, "dataBits", 8);
+		if (!PortConfig::isValidDataBits(dataBits))
+			throw std::runtime_error("Invalid value for field dataBits in configuration");
+
+		int stopBits = getInt(portValue, "stopBits", 1);
+		if (!PortConfig::isValidStopBits(stopBits))
+			throw std::runtime_error("Invalid value for field stopBits in configuration");
+
+		PortConfig::Parity parity;
+		if (string str = getString(portValue, "parity", "even"); !PortConfig::isValidParity(str, parity))
+			throw std::runtime_error("Invalid value " + str + " for field parity in configuration");
+
+		serialPort = modbus::Config::SerialPort(name, baudRate, dataBits, stopBits, parity);
+	}
+
+	int delay = getInt(value, "turnaroundDelay", 0);
+	if (delay < 0)
+		throw std::runtime_error("Invalid value " + cnvToStr(delay) + " for field turnaroundDelay in configuration");
+	modbus::Config::Milliseconds turnaroundDelay(delay);
+	std::map<Byte, modbus::Config::Milliseconds> unitTurnaroundDelays;
+	if (hasMember(value, "units"))
+		for (auto& unitValue : getArray(value, "units").GetArray())
+		{
+			int unitDelay = getInt(unitValue, "turnaroundDelay");
+			if (unitDelay < 0)
+				throw std::runtime_error("Invalid value " + cnvToStr(unitDelay) + " for field turnaroundDelay in configuration");
+			unitTurnaroundDelays[getByte(unitValue, "unitId")] = modbus::Config::Milliseconds(unitDelay);
+		}
 
 	bool logRawData = getBool(value, "logRawData", false);
 	bool logMsgs = getBool(value, "logMessages", false);
 
 	Seconds reconnectInterval(getInt(value, "reconnectInterval", 60));
+	Seconds connectTimeout(getInt(value, "connectTimeout", 10));
+
+	int maxRegisterGap = getInt(value, "maxRegisterGap", 0);
+	if (maxRegisterGap < 0 || maxRegisterGap >= modbus::MAX_READ_REGISTERS)
+		throw std::runtime_error("Invalid value " + cnvToStr(maxRegisterGap) + " for field maxRegisterGap in configuration");
+
+	// transaction ids have 16 bits
+	int maxInFlight = getInt(value, "maxInFlight", 4);
+	if (maxInFlight < 1 || maxInFlight > 65535)
+		throw std::runtime_error("Invalid value " + cnvToStr(maxInFlight) + " for field maxInFlight in configuration");
+
+	int maxRequests = getInt(value, "maxRequests", 0);
+	if (maxRequests < 0)
+		throw std::runtime_error("Invalid value " + cnvToStr(maxRequests) + " for field maxRequests in configuration");
+
+	Seconds maxCacheAge(getInt(value, "maxCacheAge", 0));
+
+	// either a list of devices or a single device given by hostname and port
+	modbus::Config::Devices devices;
+	if (serialPort.name == "")
+	{
+		if (hasMember(value, "devices"))
+			for (auto& deviceValue : getArray(value, "devices").GetArray())
+			{
+				string name = getString(deviceValue, "name");
+				for (auto& device : devices)
+					if (device.name == name)
+						throw std::runtime_error("Invalid value " + name + " for field name in configuration");
+
+				int deviceMaxInFlight = getInt(deviceValue, "maxInFlight", maxInFlight);
+				if (deviceMaxInFlight < 1 || deviceMaxInFlight > 65535)
+					throw std::runtime_error("Invalid value " + cnvToStr(deviceMaxInFlight) + " for field maxInFlight in configuration");
+
+				devices.push_back(modbus::Config::Device(name, getString(deviceValue, "hostname"),
+					getInt(deviceValue, "port", 502), deviceMaxInFlight));
+			}
+		else
+			devices.push_back(modbus::Config::Device("", getString(value, "hostname"), getInt(value, "port", 502), maxInFlight));
+	}
 
 	modbus::Config::Bindings bindings;
 	for (auto& bindingValue : getArray(value, "bindings").GetArray())
 	{
+		string device = hasMember(value, "devices") ? getString(bindingValue, "device") : "";
 		Byte unitId = getByte(bindingValue, "unitId");
 		int valueRegister = getInt(bindingValue, "valueRegister");
 		int valueRegisterCount = getInt(bindingValue, "valueRegisterCount", 1);
 		int factorRegister = getInt(bindingValue, "factorRegister", -1);
 
 		for (string itemId : getStrings(bindingValue, "itemId"))
-			bindings.add(modbus::Config::Binding(itemId, unitId, valueRegister, valueRegisterCount, factorRegister));
+			bindings.add(modbus::Config::Binding(itemId, device, unitId, valueRegister, valueRegisterCount, factorRegister));
 	}
 
-	return modbus::Config(hostname, port, reconnectInterval, logRawData, logMsgs, bindings);
+	return modbus::Config(devices, serialPort, turnaroundDelay, unitTurnaroundDelays, reconnectInterval, connectTimeout, maxRegisterGap, maxRequests, maxCacheAge, logRawData, logMsgs, bindings);
 }
 
 storage::Config Config::getStorageConfig(const rapidjson::Value& value) const
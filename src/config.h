@@ -29,6 +29,10 @@ namespace calculator
 {
 class Config;
 }
+namespace httpserver
+{
+class Config;
+}
 
 class GlobalConfig
 {
@@ -70,6 +74,7 @@ private:
 	HttpConfig getHttpConfig(const rapidjson::Value& value) const;
 	TcpConfig getTcpConfig(const rapidjson::Value& value) const;
 	modbus::Config getModbusConfig(const rapidjson::Value& value) const;
+	httpserver::Config getHttpServerConfig(const rapidjson::Value& value) const;
 
 public:
 	Config() {}
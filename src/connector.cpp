@@ -0,0 +1,158 @@
+#include <sys/socket.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <errno.h>
+
+#include <atomic>
+#include <thread>
+
+#include "connector.h"
+#include "logger.h"
+#include "finally.h"
+
+// Result of a name resolution. It is shared with the resolving thread, so an abandoned
+// resolution is cleaned up by whichever side finishes last.
+struct TcpConnector::Resolution
+{
+	std::atomic<bool> done;
+	int rc;
+	addrinfo* addrs;
+
+	Resolution() : done(false), rc(0), addrs(nullptr) {}
+	~Resolution() { if (addrs) freeaddrinfo(addrs); }
+};
+
+TcpConnector::TcpConnector(string hostname, int port, Seconds connectTimeout) :
+	hostname(hostname), port(port), connectTimeout(connectTimeout), state(IDLE), nextAddr(nullptr), fd(-1)
+{
+}
+
+void TcpConnector::start()
+{
+	reset();
+
+	deadline = Stopwatch::Clock::now() + connectTimeout;
+	resolution = std::make_shared<Resolution>();
+	state = RESOLVING;
+
+	std::thread([resolution = resolution, hostname = hostname, port = port]
+	{
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_TCP;
+		hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+		resolution->rc = getaddrinfo(hostname.c_str(), cnvToStr(port).c_str(), &hints, &resolution->addrs);
+		resolution->done.store(true, std::memory_order_release);
+	}).detach();
+}
+
+void TcpConnector::reset()
+{
+	if (fd != -1)
+		::close(fd);
+	fd = -1;
+	nextAddr = nullptr;
+	resolution.reset();
+	state = IDLE;
+}
+
+void TcpConnector::connectNext(int error)
+{
+	for (; nextAddr; nextAddr = nextAddr->ai_next)
+	{
+		if (fd != -1)
+			::close(fd);
+
+		fd = ::socket(nextAddr->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd == -1)
+		{
+			error = errno;
+			continue;
+		}
+
+		if (connect(fd, nextAddr->ai_addr, nextAddr->ai_addrlen) == 0 || errno == EINPROGRESS)
+		{
+			nextAddr = nextAddr->ai_next;
+			state = CONNECTING;
+			return;
+		}
+		error = errno;
+	}
+
+	errno = error;
+	Error() << unixError("connect") << endOfMsg();
+}
+
+int TcpConnector::process()
+{
+	if (state == IDLE)
+		return -1;
+
+	auto autoReset = finally([this] { reset(); });
+
+	if (state == RESOLVING)
+	{
+		if (!resolution->done.load(std::memory_order_acquire))
+		{
+			if (Stopwatch::Clock::now() > deadline)
+				Error() << "Name resolution for " << hostname << " timed out" << endOfMsg();
+			autoReset.disable();
+			return -1;
+		}
+
+		if (resolution->rc != 0)
+			Error() << "Error " << resolution->rc << " (" << gai_strerror(resolution->rc) << ") occurred in function getaddrinfo" << endOfMsg();
+
+		// the resolution is kept as it owns the remaining addresses
+		nextAddr = resolution->addrs;
+		connectNext(EADDRNOTAVAIL);
+	}
+
+	// connection established or failed?
+	pollfd pfd = {fd, POLLOUT, 0};
+	int rc = poll(&pfd, 1, 0);
+	if (rc == -1)
+		Error() << unixError("poll") << endOfMsg();
+	if (rc == 0)
+	{
+		if (Stopwatch::Clock::now() > deadline)
+			Error() << "Connection to " << hostname << ":" << port << " timed out" << endOfMsg();
+		autoReset.disable();
+		return -1;
+	}
+
+	int error = 0;
+	socklen_t length = sizeof(error);
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+		Error() << unixError("getsockopt") << endOfMsg();
+	if (error != 0)
+	{
+		// try the next address within the same deadline
+		connectNext(error);
+		autoReset.disable();
+		return -1;
+	}
+
+	// pass the socket to the caller
+	int connectedFd = fd;
+	fd = -1;
+	return connectedFd;
+}
+
+long TcpConnector::collectFds(fd_set* writeFds, int* maxFd) const
+{
+	if (state == IDLE)
+		return -1;
+
+	long remainingMs = std::max(0L, long(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Stopwatch::Clock::now()).count()));
+
+	// the resolving thread gives no signal, hence poll its result
+	if (state == RESOLVING)
+		return std::min(remainingMs, 50L);
+
+	FD_SET(fd, writeFds);
+	*maxFd = std::max(*maxFd, fd);
+	return remainingMs;
+}
@@ -0,0 +1,65 @@
+#ifndef CONNECTOR_H
+#define CONNECTOR_H
+
+#include <memory>
+#include <sys/select.h>
+
+#include "basic.h"
+
+// Establishes a TCP connection without blocking the caller. The host name is resolved in a
+// separate thread and the connection is set up on a non-blocking socket whose completion is
+// signalled by the socket becoming writable. If the host name resolves to several addresses they
+// are tried in turn. All steps together are limited by a timeout.
+class TcpConnector
+{
+private:
+	struct Resolution;
+
+	enum State
+	{
+		IDLE,
+		RESOLVING,
+		CONNECTING
+	};
+
+	string hostname;
+	int port;
+	Seconds connectTimeout;
+
+	State state;
+	std::shared_ptr<Resolution> resolution;
+	// Resolved address to try after the current one.
+	struct addrinfo* nextAddr;
+	int fd;
+	Stopwatch::Clock::time_point deadline;
+
+public:
+	TcpConnector(string hostname, int port, Seconds connectTimeout);
+	TcpConnector(const TcpConnector&) = delete;
+	TcpConnector& operator=(const TcpConnector&) = delete;
+	~TcpConnector() { reset(); }
+
+	// Starts a new connection attempt.
+	void start();
+
+	// Aborts the ongoing connection attempt.
+	void reset();
+
+	bool isActive() const { return state != IDLE; }
+
+	// Advances the ongoing connection attempt. Returns the connected non-blocking socket, whose
+	// ownership passes to the caller, or -1 as long as the attempt is in progress. Throws an
+	// exception if the attempt has failed.
+	int process();
+
+	// Adds the file descriptor to wait for and returns the time in ms after which process()
+	// should be called at the latest (-1 if not active).
+	long collectFds(fd_set* writeFds, int* maxFd) const;
+
+private:
+	// Starts connecting to the next resolved address which accepts the connect request. Throws
+	// an exception with the passed error if no address is left.
+	void connectNext(int error);
+};
+
+#endif
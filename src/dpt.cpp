@@ -0,0 +1,541 @@
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <iomanip>
+
+#include "dpt.h"
+
+static_assert(sizeof(uint32_t) == sizeof(float), "uint32_t and float do not have the same size");
+static_assert(std::numeric_limits<float>::is_iec559, "float is not IEEE-754 encoded");
+
+// Numbers are also accepted as boolean (false = 0, true = 1) and void (= 1).
+static bool getNumber(const Value& value, double& d)
+{
+	if (value.isNumber())
+		d = value.getNumber();
+	else if (value.isBoolean())
+		d = value.getBoolean();
+	else if (value.isVoid())
+		d = 1;
+	else
+		return false;
+	return true;
+}
+
+static bool getLocalTime(const Value& value, std::tm& tm)
+{
+	if (!value.isTimePoint())
+		return false;
+	std::time_t time = Clock::to_time_t(value.getTimePoint());
+	return localtime_r(&time, &tm);
+}
+
+static Value newLocalTime(std::tm& tm)
+{
+	tm.tm_isdst = -1;
+	std::time_t time = std::mktime(&tm);
+	if (time == -1)
+		return Value();
+	return Value::newTimePoint(Clock::from_time_t(time));
+}
+
+static void putUInt(Byte* data, uint32_t i, int size)
+{
+	for (int pos = size - 1; pos >= 0; pos--, i >>= 8)
+		data[pos] = i & 0xFF;
+}
+
+static uint32_t getUInt(const Byte* data, int size)
+{
+	uint32_t i = 0;
+	for (int pos = 0; pos < size; pos++)
+		i = i << 8 | data[pos];
+	return i;
+}
+
+// DPT 1 - boolean
+static bool encodeDpt1(const Value& value, Byte* data)
+{
+	if (!value.isBoolean() && !value.isNumber() && !value.isVoid())
+		return false;
+	bool b = value.isBoolean() ? value.getBoolean() : (value.isNumber() ? value.getNumber() > 0 : true);
+	data[0] |= b ? 0x01 : 0x00;
+	return true;
+}
+
+static Value decodeDpt1(ByteView data)
+{
+	return Value::newBoolean(data[0] & 0x01);
+}
+
+// DPT 2 - 1 bit controlled, number = control bit * 2 + value bit
+static bool encodeDpt2(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d) || d < 0 || d > 3)
+		return false;
+	data[0] |= Byte(d) & 0x03;
+	return true;
+}
+
+static Value decodeDpt2(ByteView data)
+{
+	return Value::newNumber(data[0] & 0x03);
+}
+
+// DPT 3 - 3 bit controlled, number = step code (1 to 7) with positive sign for increase, negative sign
+// for decrease and 0 for break
+static bool encodeDpt3(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d) || d < -7 || d > 7)
+		return false;
+	int i = d;
+	data[0] |= (i > 0 ? 0x08 : 0x00) | (std::abs(i) & 0x07);
+	return true;
+}
+
+static Value decodeDpt3(ByteView data)
+{
+	int stepCode = data[0] & 0x07;
+	return Value::newNumber(data[0] & 0x08 ? stepCode : -stepCode);
+}
+
+// DPT 5 - 8 bit unsigned
+static bool encodeDpt5(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d) || d < 0 || d > 255)
+		return false;
+	data[1] = d;
+	return true;
+}
+
+static Value decodeDpt5(ByteView data)
+{
+	return Value::newNumber(data[1]);
+}
+
+// DPT 5.001 - percentage (0 to 100)
+static bool encodeDpt5_001(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d) || d < 0 || d > 100)
+		return false;
+	data[1] = Byte(d * 255.0 / 100.0);
+	return true;
+}
+
+static Value decodeDpt5_001(ByteView data)
+{
+	return Value::newNumber(data[1] * 100.0 / 255.0);
+}
+
+// DPT 6 - 8 bit signed
+static bool encodeDpt6(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d) || d < -128 || d > 127)
+		return false;
+	data[1] = int8_t(d);
+	return true;
+}
+
+static Value decodeDpt6(ByteView data)
+{
+	return Value::newNumber(int8_t(data[1]));
+}
+
+// DPT 7 - 16 bit unsigned
+static bool encodeDpt7(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d) || d < 0 || d > 65535)
+		return false;
+	putUInt(data + 1, uint16_t(d), 2);
+	return true;
+}
+
+static Value decodeDpt7(ByteView data)
+{
+	return Value::newNumber(getUInt(&data[1], 2));
+}
+
+// DPT 8 - 16 bit signed
+static bool encodeDpt8(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d) || d < -32768 || d > 32767)
+		return false;
+	putUInt(data + 1, uint16_t(int16_t(d)), 2);
+	return true;
+}
+
+static Value decodeDpt8(ByteView data)
+{
+	return Value::newNumber(int16_t(getUInt(&data[1], 2)));
+}
+
+// DPT 9 - 16 bit float: 0.01 * M * 2^E with 12 bit mantissa M (two's complement) and 4 bit exponent E
+static bool encodeDpt9(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d) || d < -671088.64 || d > 670760.96)
+		return false;
+
+	// the exponent is given by the number of bits the mantissa exceeds 11 bits (sign bit excluded)
+	int32_t M = d * 100.0;
+	uint32_t magnitude = M < 0 ? ~M : M;
+	int32_t E = magnitude > 0x07FF ? 21 - __builtin_clz(magnitude) : 0;
+	if (E > 15)
+		return false;
+	M >>= E;
+
+	data[1] = (M < 0 ? 0x80 : 0x00) | E << 3 | (M >> 8 & 0x07);
+	data[2] = M & 0xFF;
+	return true;
+}
+
+static Value decodeDpt9(ByteView data)
+{
+	int32_t E = (data[1] >> 3) & 0x0F;
+	int32_t M = (data[1] & 0x07) << 8 | data[2];
+	if (data[1] & 0x80)
+		return Value::newNumber(((2048 - M) << E) / -100.0);
+	else
+		return Value::newNumber((M << E) / 100.0);
+}
+
+// DPT 10.001 - time of day with day of week (1 = Monday, ..., 7 = Sunday)
+static bool encodeDpt10(const Value& value, Byte* data)
+{
+	std::tm tm;
+	if (!getLocalTime(value, tm))
+		return false;
+	int day = tm.tm_wday == 0 ? 7 : tm.tm_wday;
+	data[1] = day << 5 | tm.tm_hour;
+	data[2] = tm.tm_min;
+	data[3] = tm.tm_sec;
+	return true;
+}
+
+static Value decodeDpt10(ByteView data)
+{
+	int hour = data[1] & 0x1F;
+	int min = data[2] & 0x3F;
+	int sec = data[3] & 0x3F;
+	if (hour > 23 || min > 59 || sec > 59)
+		return Value();
+
+	// time of day is related to the current day
+	std::tm tm;
+	std::time_t now = std::time(0);
+	localtime_r(&now, &tm);
+	tm.tm_hour = hour;
+	tm.tm_min = min;
+	tm.tm_sec = sec;
+	return newLocalTime(tm);
+}
+
+// DPT 11.001 - date (years 1990 to 2089)
+static bool encodeDpt11(const Value& value, Byte* data)
+{
+	std::tm tm;
+	if (!getLocalTime(value, tm) || tm.tm_year < 90 || tm.tm_year > 189)
+		return false;
+	data[1] = tm.tm_mday;
+	data[2] = tm.tm_mon + 1;
+	data[3] = tm.tm_year % 100;
+	return true;
+}
+
+static Value decodeDpt11(ByteView data)
+{
+	int day = data[1] & 0x1F;
+	int month = data[2] & 0x0F;
+	int year = data[3] & 0x7F;
+	if (day < 1 || month < 1 || month > 12 || year > 99)
+		return Value();
+
+	std::tm tm;
+	std::memset(&tm, 0, sizeof(tm));
+	tm.tm_mday = day;
+	tm.tm_mon = month - 1;
+	tm.tm_year = year >= 90 ? year : year + 100;
+	return newLocalTime(tm);
+}
+
+// DPT 12 - 32 bit unsigned
+static bool encodeDpt12(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d) || d < 0 || d > 4294967295.0)
+		return false;
+	putUInt(data + 1, uint32_t(d), 4);
+	return true;
+}
+
+static Value decodeDpt12(ByteView data)
+{
+	return Value::newNumber(getUInt(&data[1], 4));
+}
+
+// DPT 13 - 32 bit signed
+static bool encodeDpt13(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d) || d < -2147483648.0 || d > 2147483647.0)
+		return false;
+	putUInt(data + 1, uint32_t(int32_t(d)), 4);
+	return true;
+}
+
+static Value decodeDpt13(ByteView data)
+{
+	return Value::newNumber(int32_t(getUInt(&data[1], 4)));
+}
+
+// DPT 14 - 32 bit float (IEEE 754)
+static bool encodeDpt14(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d))
+		return false;
+	float f = d;
+	uint32_t i;
+	std::memcpy(&i, &f, sizeof(i));
+	putUInt(data + 1, i, 4);
+	return true;
+}
+
+static Value decodeDpt14(ByteView data)
+{
+	uint32_t i = getUInt(&data[1], 4);
+	float f;
+	std::memcpy(&f, &i, sizeof(f));
+	return Value::newNumber(f);
+}
+
+// DPT 16 - string of 14 characters, padded with NUL characters
+static bool encodeDpt16(const Value& value, Byte* data)
+{
+	if (!value.isString() || value.getString().length() > 14)
+		return false;
+	const string& str = value.getString();
+	std::memset(data + 1, 0, 14);
+	std::memcpy(data + 1, str.data(), str.length());
+	return true;
+}
+
+static Value decodeDpt16(ByteView data)
+{
+	ByteView chars = data.substr(1);
+	return Value::newString(cnvToAsciiStr(chars.substr(0, chars.find_last_not_of('\0') + 1)));
+}
+
+// DPT 17 - scene number (0 to 63)
+static bool encodeDpt17(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d) || d < 0 || d > 63)
+		return false;
+	data[1] = d;
+	return true;
+}
+
+static Value decodeDpt17(ByteView data)
+{
+	return Value::newNumber(data[1] & 0x3F);
+}
+
+// DPT 18 - scene control, number = scene number (0 to 63) + 128 for learning the scene
+static bool encodeDpt18(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d) || d < 0 || d > 255 || (Byte(d) & 0x40))
+		return false;
+	data[1] = d;
+	return true;
+}
+
+static Value decodeDpt18(ByteView data)
+{
+	return Value::newNumber(data[1] & 0xBF);
+}
+
+// DPT 19.001 - date and time (years 1900 to 2155)
+static bool encodeDpt19(const Value& value, Byte* data)
+{
+	std::tm tm;
+	if (!getLocalTime(value, tm) || tm.tm_year < 0 || tm.tm_year > 255)
+		return false;
+	int day = tm.tm_wday == 0 ? 7 : tm.tm_wday;
+	data[1] = tm.tm_year;
+	data[2] = tm.tm_mon + 1;
+	data[3] = tm.tm_mday;
+	data[4] = day << 5 | tm.tm_hour;
+	data[5] = tm.tm_min;
+	data[6] = tm.tm_sec;
+	data[7] = 0x20 | (tm.tm_isdst > 0 ? 0x01 : 0x00);	// working day not valid, summer time
+	data[8] = 0x00;
+	return true;
+}
+
+static Value decodeDpt19(ByteView data)
+{
+	// fault, no year, no date or no time
+	if (data[7] & 0x80 || data[7] & 0x10 || data[7] & 0x08 || data[7] & 0x02)
+		return Value();
+
+	std::tm tm;
+	std::memset(&tm, 0, sizeof(tm));
+	tm.tm_year = data[1];
+	tm.tm_mon = (data[2] & 0x0F) - 1;
+	tm.tm_mday = data[3] & 0x1F;
+	tm.tm_hour = data[4] & 0x1F;
+	tm.tm_min = data[5] & 0x3F;
+	tm.tm_sec = data[6] & 0x3F;
+	if (tm.tm_mon < 0 || tm.tm_mon > 11 || tm.tm_mday < 1 || tm.tm_hour > 24 || tm.tm_min > 59 || tm.tm_sec > 59)
+		return Value();
+	return newLocalTime(tm);
+}
+
+// DPT 20 - 8 bit enumeration
+static bool encodeDpt20(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d) || d < 0 || d > 255)
+		return false;
+	data[1] = d;
+	return true;
+}
+
+static Value decodeDpt20(ByteView data)
+{
+	return Value::newNumber(data[1]);
+}
+
+// DPT 232.600 - RGB colour, number = red * 65536 + green * 256 + blue
+static bool encodeDpt232(const Value& value, Byte* data)
+{
+	double d;
+	if (!getNumber(value, d) || d < 0 || d > 0xFFFFFF)
+		return false;
+	putUInt(data + 1, uint32_t(d), 3);
+	return true;
+}
+
+static Value decodeDpt232(ByteView data)
+{
+	return Value::newNumber(getUInt(&data[1], 3));
+}
+
+static constexpr DptCodec codecs[] = {
+	{1, -1, 0, Unit::UNKNOWN, encodeDpt1, decodeDpt1},
+	{2, -1, 0, Unit::UNKNOWN, encodeDpt2, decodeDpt2},
+	{3, -1, 0, Unit::UNKNOWN, encodeDpt3, decodeDpt3},
+	{5, 1, 1, Unit::PERCENT, encodeDpt5_001, decodeDpt5_001},
+	{5, 4, 1, Unit::PERCENT, encodeDpt5, decodeDpt5},
+	{5, -1, 1, Unit::UNKNOWN, encodeDpt5, decodeDpt5},
+	{6, 1, 1, Unit::PERCENT, encodeDpt6, decodeDpt6},
+	{6, -1, 1, Unit::UNKNOWN, encodeDpt6, decodeDpt6},
+	{7, 5, 2, Unit::SECOND, encodeDpt7, decodeDpt7},
+	{7, 6, 2, Unit::MINUTE, encodeDpt7, decodeDpt7},
+	{7, 7, 2, Unit::HOUR, encodeDpt7, decodeDpt7},
+	{7, 12, 2, Unit::MILLIAMPERE, encodeDpt7, decodeDpt7},
+	{7, 13, 2, Unit::LUX, encodeDpt7, decodeDpt7},
+	{7, -1, 2, Unit::UNKNOWN, encodeDpt7, decodeDpt7},
+	{8, -1, 2, Unit::UNKNOWN, encodeDpt8, decodeDpt8},
+	{9, 1, 2, Unit::CELCIUS, encodeDpt9, decodeDpt9},
+	{9, 4, 2, Unit::LUX, encodeDpt9, decodeDpt9},
+	{9, 5, 2, Unit::METER_PER_SECOND, encodeDpt9, decodeDpt9},
+	{9, 7, 2, Unit::PERCENT, encodeDpt9, decodeDpt9},
+	{9, 20, 2, Unit::MILLIVOLT, encodeDpt9, decodeDpt9},
+	{9, 21, 2, Unit::MILLIAMPERE, encodeDpt9, decodeDpt9},
+	{9, 24, 2, Unit::KILOWATT, encodeDpt9, decodeDpt9},
+	{9, 28, 2, Unit::KILOMETER_PER_HOUR, encodeDpt9, decodeDpt9},
+	{9, 29, 2, Unit::GRAM_PER_CUBICMETER, encodeDpt9, decodeDpt9},
+	{9, -1, 2, Unit::UNKNOWN, encodeDpt9, decodeDpt9},
+	{10, -1, 3, Unit::UNKNOWN, encodeDpt10, decodeDpt10},
+	{11, -1, 3, Unit::UNKNOWN, encodeDpt11, decodeDpt11},
+	{12, -1, 4, Unit::UNKNOWN, encodeDpt12, decodeDpt12},
+	{13, 10, 4, Unit::WATTHOUR, encodeDpt13, decodeDpt13},
+	{13, 13, 4, Unit::KILOWATTHOUR, encodeDpt13, decodeDpt13},
+	{13, -1, 4, Unit::UNKNOWN, encodeDpt13, decodeDpt13},
+	{14, 19, 4, Unit::AMPERE, encodeDpt14, decodeDpt14},
+	{14, 27, 4, Unit::VOLT, encodeDpt14, decodeDpt14},
+	{14, 33, 4, Unit::HERTZ, encodeDpt14, decodeDpt14},
+	{14, 56, 4, Unit::WATT, encodeDpt14, decodeDpt14},
+	{14, -1, 4, Unit::UNKNOWN, encodeDpt14, decodeDpt14},
+	{16, -1, 14, Unit::UNKNOWN, encodeDpt16, decodeDpt16},
+	{17, -1, 1, Unit::UNKNOWN, encodeDpt17, decodeDpt17},
+	{18, -1, 1, Unit::UNKNOWN, encodeDpt18, decodeDpt18},
+	{19, -1, 8, Unit::UNKNOWN, encodeDpt19, decodeDpt19},
+	{20, -1, 1, Unit::UNKNOWN, encodeDpt20, decodeDpt20},
+	{232, -1, 3, Unit::UNKNOWN, encodeDpt232, decodeDpt232}
+};
+
+static_assert(DatapointType::maxDataLength >= 1 + 14, "APDU of DPT 16 does not fit");
+
+const DptCodec* DptCodec::find(int mainNo, int subNo)
+{
+	const DptCodec* mainCodec = nullptr;
+	for (auto& codec : codecs)
+		if (codec.mainNo == mainNo && codec.subNo == subNo)
+			return &codec;
+		else if (codec.mainNo == mainNo && codec.subNo == -1)
+			mainCodec = &codec;
+	return mainCodec;
+}
+
+string DatapointType::toStr() const
+{
+	std::ostringstream stream;
+	stream << mainNo << '.' << std::setw(3) << std::setfill('0') << subNo;
+	return stream.str();
+}
+
+bool DatapointType::fromStr(string dptStr, DatapointType& dpt)
+{
+	try
+	{
+		string::size_type pos = dptStr.find('.');
+		if (pos == 0 || pos == string::npos)
+			return false;
+
+		int mainNo = std::stoi(dptStr.substr(0, pos));
+		if (mainNo < 0 || mainNo > 999)
+			return false;
+		int subNo = std::stoi(dptStr.substr(pos + 1));
+		if (subNo < 0 || subNo > 999)
+			return false;
+
+		dpt = DatapointType(mainNo, subNo);
+
+		return true;
+	}
+	catch (const std::invalid_argument&)
+	{
+		return false;
+	}
+}
+
+int DatapointType::exportValue(const Value& value, Byte* data) const
+{
+	assert(codec);
+
+	data[0] = 0x00;
+	if (!codec->encode(value, data))
+		return 0;
+	return codec->size + 1;
+}
+
+Value DatapointType::importValue(ByteView data) const
+{
+	assert(codec);
+
+	if (data.length() != codec->size + 1)
+		return Value();
+	return codec->decode(data);
+}
@@ -0,0 +1,53 @@
+#ifndef DPT_H
+#define DPT_H
+
+#include "value.h"
+
+// Conversion between values and the APDU of a KNX group telegram for one or several datapoint
+// types. The APDU passed to encode() and decode() starts with the APCI byte. Payloads of up to 6
+// bits (size 0) are located in the lower bits of this byte, all others follow it.
+struct DptCodec
+{
+	int mainNo;
+
+	// Sub number or -1 in case the codec covers all sub numbers of the main number.
+	int subNo;
+
+	// Number of payload bytes following the APCI byte.
+	int size;
+
+	// Unit of the numbers exchanged via this DPT.
+	Unit unit;
+
+	bool (*encode)(const Value& value, Byte* data);
+	Value (*decode)(ByteView data);
+
+	// Returns the codec registered for the passed DPT or nullptr.
+	static const DptCodec* find(int mainNo, int subNo);
+};
+
+struct DatapointType
+{
+	int mainNo;
+	int subNo;
+	const DptCodec* codec;
+
+	DatapointType() : mainNo(0), subNo(0), codec(nullptr) {}
+	DatapointType(int _mainNo, int _subNo) : mainNo(_mainNo), subNo(_subNo), codec(DptCodec::find(_mainNo, _subNo)) {}
+
+	// Maximum length of the APDU (APCI and data) of a standard frame.
+	static const int maxDataLength = 15;
+
+	string toStr() const;
+	static bool fromStr(string dptStr, DatapointType& dpt);
+
+	bool isSupported() const { return codec; }
+	Unit getUnit() const { return codec ? codec->unit : Unit(Unit::UNKNOWN); }
+
+	// Writes the APDU for the passed value to data (at least maxDataLength bytes) and returns its
+	// length. 0 is returned if the value can not be converted.
+	int exportValue(const Value& value, Byte* data) const;
+	Value importValue(ByteView data) const;
+};
+
+#endif
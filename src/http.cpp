@@ -1,9 +1,17 @@
+#include <poll.h>
+#include <strings.h>
+
 #include <cstring>
+#include <cmath>
 
 #include "http.h"
+#include "finally.h"
+
+// Period over which the transfer rate is averaged
+static const double transferRatePeriod = 60;
 
 HttpHandler::HttpHandler(string _id, HttpConfig _config, Logger _logger) :
-	id(_id), config(_config), logger(_logger), handle(0)
+	id(_id), config(_config), logger(_logger), handle(0), timerActive(false), shareHandle(0), transferRate(0), transferRateTime(Clock::now())
 {
 	// boot curl
 	curl_global_init(CURL_GLOBAL_ALL);
@@ -25,14 +33,45 @@ HttpHandler::HttpHandler(string _id, HttpConfig _config, Logger _logger) :
 		msg << endOfMsg();
 	}
 
-	// allocate multi handle
+	// allocate multi handle, cURL tells via callbacks which sockets and timeout it needs
 	handle = curl_multi_init();
+	curl_multi_setopt(handle, CURLMOPT_SOCKETFUNCTION, socketCallback);
+	curl_multi_setopt(handle, CURLMOPT_SOCKETDATA, this);
+	curl_multi_setopt(handle, CURLMOPT_TIMERFUNCTION, timerCallback);
+	curl_multi_setopt(handle, CURLMOPT_TIMERDATA, this);
+
+	// allocate share handle, the handler is single threaded and hence needs no locking
+	shareHandle = curl_share_init();
+	curl_share_setopt(shareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(shareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	curl_share_setopt(shareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+	handlerState.metrics["transferRate"] = 0;
+	handlerState.metrics["newConnections"] = 0;
+	handlerState.metrics["reusedConnections"] = 0;
+	handlerState.metrics["unchangedResponses"] = 0;
 }
 
 HttpHandler::~HttpHandler()
 {
-	// free multi handle
+	// free easy handles of ongoing transfers
+	for (auto& [easyHandle, transfer] : transfers)
+	{
+		curl_multi_remove_handle(handle, easyHandle);
+		curl_easy_cleanup(easyHandle);
+	}
+
+	// free pooled easy handles
+	for (auto& [key, pool] : pools)
+	{
+		for (CURL* easyHandle : pool.idleHandles)
+			curl_easy_cleanup(easyHandle);
+		curl_slist_free_all(pool.headers);
+	}
+
+	// free multi and share handle
 	curl_multi_cleanup(handle);
+	curl_share_cleanup(shareHandle);
 
 	// shutdown curl
 	curl_global_cleanup();
@@ -57,18 +96,39 @@ void HttpHandler::validate(Items& items)
 	}
 }
 
-long HttpHandler::collectFds(fd_set* readFds, fd_set* writeFds, fd_set* excpFds, int* maxFd)
+int HttpHandler::socketCallback(CURL* easyHandle, curl_socket_t socket, int what, void* userp, void* socketp)
 {
-	long timeout;
-	CURLMcode mcode = curl_multi_timeout(handle, &timeout);
-	handleMultiError("curl_multi_timeout", mcode, logger.error());
+	HttpHandler* handler = static_cast<HttpHandler*>(userp);
+	if (what == CURL_POLL_REMOVE)
+		handler->sockets.erase(socket);
+	else
+		handler->sockets[socket] = what;
+	return 0;
+}
+
+int HttpHandler::timerCallback(CURLM* multiHandle, long timeoutMs, void* userp)
+{
+	HttpHandler* handler = static_cast<HttpHandler*>(userp);
+	handler->timerActive = timeoutMs >= 0;
+	if (handler->timerActive)
+		handler->timerDeadline = Stopwatch::Clock::now() + std::chrono::milliseconds(timeoutMs);
+	return 0;
+}
 
-	int curlMaxFd = -1;
-	mcode = curl_multi_fdset(handle, readFds, writeFds, excpFds, &curlMaxFd);
-	handleMultiError("curl_multi_fdset", mcode, logger.error());
-	*maxFd = std::max(*maxFd, curlMaxFd);
+long HttpHandler::collectFds(fd_set* readFds, fd_set* writeFds, fd_set* excpFds, int* maxFd)
+{
+	for (auto [socket, what] : sockets)
+	{
+		if (what & CURL_POLL_IN)
+			FD_SET(socket, readFds);
+		if (what & CURL_POLL_OUT)
+			FD_SET(socket, writeFds);
+		*maxFd = std::max(*maxFd, socket);
+	}
 
-	return timeout;
+	if (!timerActive)
+		return -1;
+	return std::max(0L, long(std::chrono::duration_cast<std::chrono::milliseconds>(timerDeadline - Stopwatch::Clock::now()).count()));
 }
 
 Events HttpHandler::receive(const Items& items)
@@ -116,6 +176,20 @@ static size_t writeCallback(char* buffer, size_t size, size_t nmemb, string* use
     return totalSize;
 }
 
+static size_t headerCallback(char* buffer, size_t size, size_t nitems, string* etag)
+{
+	size_t totalSize = size * nitems;
+	static const char tag[] = "ETag:";
+	if (etag && totalSize > sizeof(tag) - 1 && strncasecmp(buffer, tag, sizeof(tag) - 1) == 0)
+	{
+		string value(buffer + sizeof(tag) - 1, totalSize - sizeof(tag) + 1);
+		value.erase(0, value.find_first_not_of(" \t"));
+		value.erase(value.find_last_not_of(" \t\r\n") + 1);
+		*etag = value;
+	}
+	return totalSize;
+}
+
 static int debugCallback(CURL* handle, curl_infotype type, char* data, size_t size, Logger* logger)
 {
 	string logData(data, size);
@@ -135,10 +209,33 @@ Events HttpHandler::receiveX()
 {
 	Events events;
 
-	// process ongoing transfers
+	// determine which of the sockets watched for cURL are ready
+	std::vector<pollfd> pollFds;
+	pollFds.reserve(sockets.size());
+	for (auto [socket, what] : sockets)
+		pollFds.push_back({socket, short((what & CURL_POLL_IN ? POLLIN : 0) | (what & CURL_POLL_OUT ? POLLOUT : 0)), 0});
+	if (pollFds.size() && poll(pollFds.data(), pollFds.size(), 0) == -1)
+		logger.errorX() << unixError("poll") << endOfMsg();
+
+	// let cURL process ready sockets only
 	int activeHandles;
-	CURLMcode mcode = curl_multi_perform(handle, &activeHandles);
-	handleMultiError("curl_multi_perform", mcode);
+	for (auto& pollFd : pollFds)
+		if (pollFd.revents)
+		{
+			int flags = (pollFd.revents & (POLLIN | POLLHUP) ? CURL_CSELECT_IN : 0)
+			          | (pollFd.revents & POLLOUT ? CURL_CSELECT_OUT : 0)
+			          | (pollFd.revents & (POLLERR | POLLNVAL) ? CURL_CSELECT_ERR : 0);
+			CURLMcode mcode = curl_multi_socket_action(handle, pollFd.fd, flags, &activeHandles);
+			handleMultiError("curl_multi_socket_action", mcode);
+		}
+
+	// let cURL handle timeouts
+	if (timerActive && timerDeadline <= Stopwatch::Clock::now())
+	{
+		timerActive = false;
+		CURLMcode mcode = curl_multi_socket_action(handle, CURL_SOCKET_TIMEOUT, 0, &activeHandles);
+		handleMultiError("curl_multi_socket_action", mcode);
+	}
 
 	// check for finished transfers
 	CURLMsg* msg;
@@ -146,55 +243,101 @@ Events HttpHandler::receiveX()
 	while ((msg = curl_multi_info_read(handle, &waitingMessages)) != NULL)
 		if (msg->msg == CURLMSG_DONE)
 		{
-			auto transferPos = transfers.find(msg->easy_handle);
+			// message does not survive the removal of the easy handle from the multi handle
+			CURL* easyHandle = msg->easy_handle;
+			CURLcode code = msg->data.result;
+			curl_multi_remove_handle(handle, easyHandle);
+
+			auto transferPos = transfers.find(easyHandle);
 			if (transferPos != transfers.end())
 			{
-				string itemId = transferPos->second.event.getItemId();
-				string response = *transferPos->second.response;
+				auto& transfer = transferPos->second;
+				string itemId = transfer.event.getItemId();
+				string key = transfer.key;
+				bool readReq = transfer.event.getType() == EventType::READ_REQ;
+				SharedString response(std::move(*transfer.response));
+
+				// READ_REQs of a shared resource are served by one transfer for all its bindings
+				auto bindingPos = config.getBindings().find(itemId);
+				bool shared = readReq && bindingPos != config.getBindings().end() && bindingPos->second.resourceId.length();
+				string name = shared ? "resource " + bindingPos->second.resourceId : "item " + itemId;
+				if (shared)
+					readResources.erase(key);
+
+				// count connections established for the transfer, none means a warm connection was reused
+				long connects = 0;
+				if (curl_easy_getinfo(easyHandle, CURLINFO_NUM_CONNECTS, &connects) == CURLE_OK)
+					if (connects)
+						handlerState.metrics["newConnections"] += connects;
+					else if (code == CURLE_OK)
+						handlerState.metrics["reusedConnections"]++;
+
+				// unchanged poll responses are neither analyzed nor passed on
+				bool conditional = config.getSuppressUnchanged() && readReq;
+				long responseCode = 0;
+				curl_easy_getinfo(easyHandle, CURLINFO_RESPONSE_CODE, &responseCode);
+				std::size_t bodyHash = conditional ? std::hash<string>()(response.get()) : 0;
+				bool unchanged = conditional && (responseCode == 304 || validators[key].bodyHash == bodyHash);
 
 				// examine transfer result
-				CURLcode code = msg->data.result;
 				if (code != CURLE_OK)
-					logger.error() << "Transfer for item " << itemId << " failed with error code "
+					logger.error() << "Transfer for " << name << " failed with error code "
 					               << code << " (" << curl_easy_strerror(code) << ") and error details '"
-					               << transferPos->second.errorBuffer << "'" << endOfMsg();
+					               << transfer.errorBuffer << "'" << endOfMsg();
+				else if (unchanged)
+				{
+					handlerState.metrics["unchangedResponses"]++;
+
+					if (config.getLogTransfers())
+						logger.debug() << "Transfer for " << name << " completed with unchanged response" << endOfMsg();
+				}
 				else
 				{
 					if (config.getLogTransfers())
-						logger.debug() << "Transfer for item " << itemId << " completed with response '"
+						logger.debug() << "Transfer for " << name << " completed with response '"
 						               << response << "'" << endOfMsg();
 
-					auto bindingPos = config.getBindings().find(itemId);
-					if (bindingPos != config.getBindings().end())
-					{
-						auto& binding = bindingPos->second;
-
-						// compare returned response with response pattern
-						if (std::regex_search(response, binding.responsePattern))
+					// the response of a shared resource fans out to all its bindings
+					bool accepted = false;
+					for (auto& [bindingItemId, binding] : config.getBindings())
+						if (shared ? binding.getTransferKey() == key : bindingItemId == itemId)
 						{
-							if (transferPos->second.event.getType() == EventType::READ_REQ)
-								events.add(Event(id, itemId, EventType::STATE_IND, Value::newString(response)));
+							// compare returned response with response pattern
+							if (std::regex_search(response.get(), binding.responsePattern))
+							{
+								if (readReq)
+									events.add(Event(id, bindingItemId, EventType::STATE_IND, Value::newString(response)));
+								accepted = true;
+							}
+							else
+								// no match
+								logger.error() << "Response '" << response << "' for item "
+								               << bindingItemId << " not expected" << endOfMsg();
 						}
-						else
-							// no match
-							logger.error() << "Response '" << response << "' for item "
-							               << itemId << " not expected" << endOfMsg();
+
+					// remember validators for the next poll
+					if (conditional && accepted)
+					{
+						auto& keyValidators = validators[key];
+						keyValidators.etag = transfer.etag;
+						if (curl_easy_getinfo(easyHandle, CURLINFO_FILETIME, &keyValidators.lastModified) != CURLE_OK)
+							keyValidators.lastModified = -1;
+						keyValidators.bodyHash = bodyHash;
 					}
 				}
 
-				curl_slist_free_all(transferPos->second.headers);
-
 				// remove finished transfer from the list of ongoing transfers
 				transfers.erase(transferPos);
-			}
-
-			// remove easy handle from multi handle
-			curl_multi_remove_handle(handle, msg->easy_handle);
 
-			// deallocate easy handle
-			curl_easy_cleanup(msg->easy_handle);
+				// keep easy handle for the next transfer of the binding
+				releaseEasyHandle(key, easyHandle);
+			}
+			else
+				curl_easy_cleanup(easyHandle);
 		}
 
+	handlerState.metrics["transferRate"] = std::round(getTransferRate(Clock::now()) * 100) / 100;
+
 	return events;
 }
 
@@ -210,18 +353,18 @@ Events HttpHandler::sendX(const Events& events)
 		if (bindingPos != bindings.end())
 		{
 			auto& binding = bindingPos->second;
+			string key = binding.getTransferKey();
 
-			// new transfer is required
-			Transfer transfer(event);
+			// READ_REQs of a shared resource are served by an ongoing transfer
+			bool shared = event.getType() == EventType::READ_REQ && binding.resourceId.length();
+			if (shared && !readResources.insert(key).second)
+				continue;
+			auto autoUnmark = finally([&] { if (shared) readResources.erase(key); });
 
-			// allocate easy handle
-			CURL* easyHandle = curl_easy_init();
-			if (!easyHandle)
-				logger.errorX() << "Function curl_easy_init() failed" << endOfMsg();
-
-			// instruct cULR to enable TCP keep alive probes
-			CURLcode code = curl_easy_setopt(easyHandle, CURLOPT_TCP_KEEPALIVE , 1L);
-			handleError("curl_easy_setopt", code);
+			// new transfer is required, it is performed with a preconfigured easy handle of the binding
+			CURL* easyHandle = acquireEasyHandle(binding);
+			Transfer& transfer = transfers.emplace(easyHandle, Transfer(event, key)).first->second;
+			auto autoRelease = finally([&] { transfers.erase(easyHandle); releaseEasyHandle(key, easyHandle); });
 
 			// construct URL
 			string url = binding.url;
@@ -230,76 +373,185 @@ Events HttpHandler::sendX(const Events& events)
 				url.replace(pos, valueTag.length(), event.getValue().toStr());
 
 			// pass URL to cURL
-			code = curl_easy_setopt(easyHandle, CURLOPT_URL, url.c_str());
+			CURLcode code = curl_easy_setopt(easyHandle, CURLOPT_URL, url.c_str());
 			handleError("curl_easy_setopt", code);
 
-			// tell cURL that a POST instead of a GET is required
-			if (binding.request.length())
-			{
-				code = curl_easy_setopt(easyHandle, CURLOPT_POSTFIELDS, binding.request.c_str());
-				handleError("curl_easy_setopt", code);
-			}
+			// instruct cURL where to store the response
+			code = curl_easy_setopt(easyHandle, CURLOPT_WRITEDATA, transfer.response.get());
+			handleError("curl_easy_setopt", code);
 
-			// pass header to cURL
-			for (string header : binding.headers)
-			{
-				transfer.headers = curl_slist_append(transfer.headers, header.c_str());
-				if (!transfer.headers)
-					logger.errorX() << "Function curl_slist_append() failed" << endOfMsg();
-			}
-			code = curl_easy_setopt(easyHandle, CURLOPT_HTTPHEADER, transfer.headers);
+			transfer.errorBuffer[0] = 0;
+			code = curl_easy_setopt(easyHandle, CURLOPT_ERRORBUFFER , transfer.errorBuffer);
 			handleError("curl_easy_setopt", code);
 
-			// instruct cULR how to authenticate
-			if (config.getUser() != "" && config.getPassword() != "")
+			// make polls conditional on the validators of the last accepted response
+			if (config.getSuppressUnchanged() && event.getType() == EventType::READ_REQ && binding.request.empty())
 			{
-				string userPassword = config.getUser() + ":" + config.getPassword();
-				code = curl_easy_setopt(easyHandle, CURLOPT_USERPWD, userPassword.c_str());
+				code = curl_easy_setopt(easyHandle, CURLOPT_HEADERDATA, &transfer.etag);
 				handleError("curl_easy_setopt", code);
-				code = curl_easy_setopt(easyHandle, CURLOPT_HTTPAUTH, CURLAUTH_DIGEST);
-				handleError("curl_easy_setopt", code);
-			}
-
-			// instruct cURL not perform any validation of the server certificate
-			code = curl_easy_setopt(easyHandle, CURLOPT_SSL_VERIFYPEER, 0L);
-			handleError("curl_easy_setopt", code);
-			code = curl_easy_setopt(easyHandle, CURLOPT_SSL_VERIFYHOST, 0L);
-			handleError("curl_easy_setopt", code);
-
-			// instruct cURL how to handle the response
-			code = curl_easy_setopt(easyHandle, CURLOPT_WRITEFUNCTION, writeCallback);
-			handleError("curl_easy_setopt", code);
-			code = curl_easy_setopt(easyHandle, CURLOPT_WRITEDATA, transfer.response.get());
-			handleError("curl_easy_setopt", code);
 
-			// instruct cURL how to do debug logging
-			code = curl_easy_setopt(easyHandle, CURLOPT_VERBOSE, config.getVerboseMode());
-			handleError("curl_easy_setopt", code);
-			code = curl_easy_setopt(easyHandle, CURLOPT_DEBUGFUNCTION, debugCallback);
-			handleError("curl_easy_setopt", code);
-			code = curl_easy_setopt(easyHandle, CURLOPT_DEBUGDATA, &logger);
-			handleError("curl_easy_setopt", code);
+				auto& keyValidators = validators[key];
+				if (keyValidators.lastModified != -1)
+				{
+					code = curl_easy_setopt(easyHandle, CURLOPT_TIMECONDITION, long(CURL_TIMECOND_IFMODSINCE));
+					handleError("curl_easy_setopt", code);
+					code = curl_easy_setopt(easyHandle, CURLOPT_TIMEVALUE, keyValidators.lastModified);
+					handleError("curl_easy_setopt", code);
+				}
 
-			transfer.errorBuffer[0] = 0;
-			code = curl_easy_setopt(easyHandle, CURLOPT_ERRORBUFFER , transfer.errorBuffer);
-			handleError("curl_easy_setopt", code);
+				if (keyValidators.etag.length())
+				{
+					// header list of the binding extended by the entity tag
+					std::vector<string> headers(binding.headers.begin(), binding.headers.end());
+					headers.push_back("If-None-Match: " + keyValidators.etag);
+					for (string& header : headers)
+					{
+						curl_slist* newHeaders = curl_slist_append(transfer.headers.get(), header.c_str());
+						if (!newHeaders)
+							logger.errorX() << "Function curl_slist_append() failed" << endOfMsg();
+						if (!transfer.headers)
+							transfer.headers.reset(newHeaders, curl_slist_free_all);
+					}
+					code = curl_easy_setopt(easyHandle, CURLOPT_HTTPHEADER, transfer.headers.get());
+					handleError("curl_easy_setopt", code);
+				}
+			}
 
 			// add easy handle to multi handle
 			CURLMcode mcode = curl_multi_add_handle(handle, easyHandle);
 			handleMultiError("curl_multi_add_handle", mcode);
+			autoRelease.disable();
+			autoUnmark.disable();
 
 			if (config.getLogTransfers())
-				logger.debug() << "Transfer for item " << itemId << " to URL " << url
+				logger.debug() << "Transfer for " << (shared ? "resource " + binding.resourceId : "item " + itemId) << " to URL " << url
 				               << " started with request '" << binding.request << "'" << endOfMsg();
 
-			// add new transfer to the list of ongoing transfers
-			transfers.insert({easyHandle, transfer});
+			// account transfer in the transfer rate
+			transferRate = getTransferRate(Clock::now()) + 1 / transferRatePeriod;
 		}
 	}
 
 	return Events();
 }
 
+CURL* HttpHandler::acquireEasyHandle(const HttpConfig::Binding& binding)
+{
+	auto& pool = pools[binding.getTransferKey()];
+	if (!pool.idleHandles.empty())
+	{
+		CURL* easyHandle = pool.idleHandles.back();
+		pool.idleHandles.pop_back();
+		return easyHandle;
+	}
+
+	// header list is built once per binding and shared by its easy handles
+	if (!pool.headers)
+		for (string header : binding.headers)
+		{
+			curl_slist* headers = curl_slist_append(pool.headers, header.c_str());
+			if (!headers)
+				logger.errorX() << "Function curl_slist_append() failed" << endOfMsg();
+			pool.headers = headers;
+		}
+
+	// allocate easy handle
+	CURL* easyHandle = curl_easy_init();
+	if (!easyHandle)
+		logger.errorX() << "Function curl_easy_init() failed" << endOfMsg();
+	auto autoCleanup = finally([easyHandle] { curl_easy_cleanup(easyHandle); });
+
+	// instruct cURL to use the DNS cache, TLS sessions and connections of the other transfers
+	CURLcode code = curl_easy_setopt(easyHandle, CURLOPT_SHARE, shareHandle);
+	handleError("curl_easy_setopt", code);
+
+	// instruct cULR to keep idle connections alive via TCP keep alive probes
+	code = curl_easy_setopt(easyHandle, CURLOPT_TCP_KEEPALIVE , 1L);
+	handleError("curl_easy_setopt", code);
+	code = curl_easy_setopt(easyHandle, CURLOPT_TCP_KEEPIDLE, 30L);
+	handleError("curl_easy_setopt", code);
+	code = curl_easy_setopt(easyHandle, CURLOPT_TCP_KEEPINTVL, 30L);
+	handleError("curl_easy_setopt", code);
+	code = curl_easy_setopt(easyHandle, CURLOPT_MAXAGE_CONN, long(config.getMaxConnectionAge().count()));
+	handleError("curl_easy_setopt", code);
+
+	// tell cURL that a POST instead of a GET is required
+	if (binding.request.length())
+	{
+		code = curl_easy_setopt(easyHandle, CURLOPT_POSTFIELDS, binding.request.c_str());
+		handleError("curl_easy_setopt", code);
+	}
+
+	// pass header to cURL
+	code = curl_easy_setopt(easyHandle, CURLOPT_HTTPHEADER, pool.headers);
+	handleError("curl_easy_setopt", code);
+
+	// instruct cULR how to authenticate
+	if (config.getUser() != "" && config.getPassword() != "")
+	{
+		string userPassword = config.getUser() + ":" + config.getPassword();
+		code = curl_easy_setopt(easyHandle, CURLOPT_USERPWD, userPassword.c_str());
+		handleError("curl_easy_setopt", code);
+		code = curl_easy_setopt(easyHandle, CURLOPT_HTTPAUTH, CURLAUTH_DIGEST);
+		handleError("curl_easy_setopt", code);
+	}
+
+	// instruct cURL not perform any validation of the server certificate
+	code = curl_easy_setopt(easyHandle, CURLOPT_SSL_VERIFYPEER, 0L);
+	handleError("curl_easy_setopt", code);
+	code = curl_easy_setopt(easyHandle, CURLOPT_SSL_VERIFYHOST, 0L);
+	handleError("curl_easy_setopt", code);
+
+	// instruct cURL how to handle the response
+	code = curl_easy_setopt(easyHandle, CURLOPT_WRITEFUNCTION, writeCallback);
+	handleError("curl_easy_setopt", code);
+
+	// instruct cURL to provide the validators of responses
+	if (config.getSuppressUnchanged())
+	{
+		code = curl_easy_setopt(easyHandle, CURLOPT_HEADERFUNCTION, headerCallback);
+		handleError("curl_easy_setopt", code);
+		code = curl_easy_setopt(easyHandle, CURLOPT_FILETIME, 1L);
+		handleError("curl_easy_setopt", code);
+	}
+
+	// instruct cURL how to do debug logging
+	code = curl_easy_setopt(easyHandle, CURLOPT_VERBOSE, long(config.getVerboseMode()));
+	handleError("curl_easy_setopt", code);
+	code = curl_easy_setopt(easyHandle, CURLOPT_DEBUGFUNCTION, debugCallback);
+	handleError("curl_easy_setopt", code);
+	code = curl_easy_setopt(easyHandle, CURLOPT_DEBUGDATA, &logger);
+	handleError("curl_easy_setopt", code);
+
+	autoCleanup.disable();
+	return easyHandle;
+}
+
+void HttpHandler::releaseEasyHandle(string key, CURL* easyHandle)
+{
+	// the buffers of the finished transfer must not be touched anymore
+	curl_easy_setopt(easyHandle, CURLOPT_WRITEDATA, nullptr);
+	curl_easy_setopt(easyHandle, CURLOPT_ERRORBUFFER, nullptr);
+	curl_easy_setopt(easyHandle, CURLOPT_HEADERDATA, nullptr);
+
+	// drop the conditions of the finished transfer
+	auto& pool = pools[key];
+	curl_easy_setopt(easyHandle, CURLOPT_HTTPHEADER, pool.headers);
+	curl_easy_setopt(easyHandle, CURLOPT_TIMECONDITION, long(CURL_TIMECOND_NONE));
+
+	pool.idleHandles.push_back(easyHandle);
+}
+
+double HttpHandler::getTransferRate(TimePoint now)
+{
+	if (now > transferRateTime)
+	{
+		transferRate *= std::exp(-std::chrono::duration<double>(now - transferRateTime).count() / transferRatePeriod);
+		transferRateTime = now;
+	}
+	return transferRate;
+}
+
 void HttpHandler::handleError(string funcName, CURLcode errorCode, LogMsg logMsg) const
 {
 	if (errorCode != CURLE_OK)
@@ -4,6 +4,8 @@
 #include <curl/curl.h>
 
 #include <regex>
+#include <optional>
+#include <set>
 
 #include "link.h"
 #include "logger.h"
@@ -13,12 +15,17 @@ class HttpConfig
 public:
 	struct Binding {
 		string itemId;
+		// Shared resource whose transfers feed all its bindings, empty if the binding has its own transfers.
+		string resourceId;
 		string url;
 		std::unordered_set<string> headers;
 		string request;
 		std::regex responsePattern;
-		Binding(string itemId, string url, std::unordered_set<string> headers, string request, std::regex responsePattern) :
-			itemId(itemId), url(url), headers(headers), request(request), responsePattern(responsePattern) {}
+		Binding(string itemId, string resourceId, string url, std::unordered_set<string> headers, string request, std::regex responsePattern) :
+			itemId(itemId), resourceId(resourceId), url(url), headers(headers), request(request), responsePattern(responsePattern) {}
+
+		// Identifies the transfers of the binding, their easy handles and validators.
+		string getTransferKey() const { return resourceId.length() ? "resource " + resourceId : "item " + itemId; }
 	};
 	class Bindings: public std::map<string, Binding>
 	{
@@ -31,15 +38,25 @@ private:
 	string password;
 	bool logTransfers;
 	bool verboseMode;
+
+	// Time span after which idle connections are no longer reused.
+	Seconds maxConnectionAge;
+
+	// Polls are sent as conditional requests and unchanged responses generate no STATE_IND.
+	bool suppressUnchanged;
+
 	Bindings bindings;
 
 public:
-	HttpConfig(string user, string password, bool logTransfers, bool verboseMode, Bindings bindings) :
-		user(user), password(password), logTransfers(logTransfers), verboseMode(verboseMode), bindings(bindings) {}
+	HttpConfig(string user, string password, bool logTransfers, bool verboseMode, Seconds maxConnectionAge, bool suppressUnchanged, Bindings bindings) :
+		user(user), password(password), logTransfers(logTransfers), verboseMode(verboseMode),
+		maxConnectionAge(maxConnectionAge), suppressUnchanged(suppressUnchanged), bindings(bindings) {}
 	string getUser() const { return user; }
 	string getPassword() const { return password; }
 	bool getLogTransfers() const { return logTransfers; }
 	bool getVerboseMode() const { return verboseMode; }
+	Seconds getMaxConnectionAge() const { return maxConnectionAge; }
+	bool getSuppressUnchanged() const { return suppressUnchanged; }
 	const Bindings& getBindings() const { return bindings; }
 };
 
@@ -53,24 +70,66 @@ private:
 	// Multi handle used for all easy handles
 	CURLM* handle;
 
+	// Sockets cURL wants to be watched (socket -> CURL_POLL_IN, CURL_POLL_OUT or CURL_POLL_INOUT)
+	std::map<curl_socket_t, int> sockets;
+
+	// Point in time when cURL wants to be called for timeout handling
+	bool timerActive;
+	Stopwatch::Clock::time_point timerDeadline;
+
+	// Share handle through which all easy handles use the same DNS cache, TLS sessions and connections
+	CURLSH* shareHandle;
+
+	// Preconfigured easy handles of a binding which are currently not in use
+	struct Pool
+	{
+		curl_slist* headers = 0;
+		std::vector<CURL*> idleHandles;
+	};
+
+	// Mapping from transfer key to easy handle pool
+	std::map<string, Pool> pools;
+
+	// Validators of the last accepted poll response of a binding
+	struct Validators
+	{
+		string etag;
+		long lastModified = -1;
+		std::optional<std::size_t> bodyHash;
+	};
+
+	// Mapping from transfer key to validators
+	std::map<string, Validators> validators;
+
 	// Information stored per ongoing transfer
 	struct Transfer
 	{
 		Event event;
-		curl_slist* headers;
+		string key;
+		std::shared_ptr<curl_slist> headers;
 		std::shared_ptr<string> response;
+		string etag;
 		char errorBuffer[CURL_ERROR_SIZE];
-		Transfer(Event event) : event(event), headers(0), response(new string()) {}
+		Transfer(Event event, string key) : event(event), key(key), response(new string()) {}
 	};
 
 	// Mapping from easy handle to transfer information
 	std::map<CURL*, Transfer> transfers;
 
+	// Shared resources with an ongoing READ_REQ transfer, further READ_REQs are served by it
+	std::set<string> readResources;
+
+	// Exponentially decaying number of transfers started per second
+	double transferRate;
+	TimePoint transferRateTime;
+
+	HandlerState handlerState;
+
 public:
 	HttpHandler(string _id, HttpConfig _config, Logger _logger);
 	virtual ~HttpHandler();
 	void validate(Items& items) override;
-	virtual HandlerState getState() const override { return HandlerState(); }
+	virtual HandlerState getState() const override { return handlerState; }
 	virtual long collectFds(fd_set* readFds, fd_set* writeFds, fd_set* excpFds, int* maxFd) override;
 	virtual Events receive(const Items& items) override;
 	virtual Events send(const Items& items, const Events& events) override;
@@ -78,6 +137,11 @@ public:
 private:
 	Events receiveX();
 	Events sendX(const Events& events);
+	static int socketCallback(CURL* easyHandle, curl_socket_t socket, int what, void* userp, void* socketp);
+	static int timerCallback(CURLM* multiHandle, long timeoutMs, void* userp);
+	CURL* acquireEasyHandle(const HttpConfig::Binding& binding);
+	void releaseEasyHandle(string key, CURL* easyHandle);
+	double getTransferRate(TimePoint now);
 	void handleError(string funcName, CURLcode errorCode, LogMsg logMsg) const;
 	void handleError(string funcName, CURLcode errorCode) const;
 	void handleMultiError(string funcName, CURLMcode errorCode, LogMsg logMsg) const;
@@ -0,0 +1,455 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <errno.h>
+#include <strings.h>
+
+#include <charconv>
+
+#include "httpserver.h"
+#include "finally.h"
+
+namespace httpserver
+{
+
+static string getReasonPhrase(int status)
+{
+	switch (status)
+	{
+	case 200: return "OK";
+	case 400: return "Bad Request";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 413: return "Content Too Large";
+	case 431: return "Request Header Fields Too Large";
+	case 501: return "Not Implemented";
+	default: return "Internal Server Error";
+	}
+}
+
+static std::string_view trim(std::string_view s)
+{
+	while (s.size() && (s.front() == ' ' || s.front() == '\t'))
+		s.remove_prefix(1);
+	while (s.size() && (s.back() == ' ' || s.back() == '\t'))
+		s.remove_suffix(1);
+	return s;
+}
+
+static bool equalsIgnoreCase(std::string_view s1, std::string_view s2)
+{
+	return s1.size() == s2.size() && strncasecmp(s1.data(), s2.data(), s1.size()) == 0;
+}
+
+Handler::Handler(string id, Config config, Logger logger) :
+	id(id), config(config), logger(logger), listenFd(-1), lastOpenTry(0)
+{
+	handlerState.metrics["connections"] = 0;
+	handlerState.metrics["requests"] = 0;
+}
+
+Handler::~Handler()
+{
+	close();
+}
+
+void Handler::validate(Items& items)
+{
+	auto& bindings = config.getBindings();
+
+	for (auto& [itemId, item] : items)
+		if (item.getOwnerId() == id && !bindings.count(itemId))
+			throw std::runtime_error("Item " + itemId + " has no binding for link " + id);
+
+	for (auto& [itemId, binding] : bindings)
+	{
+		auto& item = items.validate(itemId);
+		if (binding.eventType == EventType::STATE_IND)
+		{
+			item.validateOwnerId(id);
+			item.setReadable(false);
+			item.setWritable(false);
+		}
+		else if (item.getOwnerId() == id)
+			throw std::runtime_error("Item " + itemId + " with WRITE_REQ binding must not be owned by link " + id);
+	}
+}
+
+bool Handler::open()
+{
+	// already listening?
+	if (listenFd >= 0)
+		return true;
+
+	// shell we perform another attempt to open the listening socket?
+	std::time_t now = std::time(0);
+	if (lastOpenTry + config.getReopenInterval().count() > now)
+		return false;
+	lastOpenTry = now;
+
+	listenFd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listenFd == -1)
+		logger.errorX() << unixError("socket") << endOfMsg();
+	auto autoClose = finally([this] { ::close(listenFd); listenFd = -1; });
+
+	int flag = 1;
+	if (setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag)) == -1)
+		logger.errorX() << unixError("setsockopt(SO_REUSEADDR)") << endOfMsg();
+
+	sockaddr_in localAddr = {};
+	localAddr.sin_family = AF_INET;
+	localAddr.sin_addr.s_addr = htonl(config.getLocalIpAddr());
+	localAddr.sin_port = htons(config.getPort());
+	if (::bind(listenFd, reinterpret_cast<sockaddr*>(&localAddr), sizeof(localAddr)) == -1)
+		logger.errorX() << unixError("bind") << endOfMsg();
+
+	if (::listen(listenFd, SOMAXCONN) == -1)
+		logger.errorX() << unixError("listen") << endOfMsg();
+
+	autoClose.disable();
+
+	logger.info() << "Listening on " << config.getLocalIpAddr().toStr() << ":" << config.getPort() << endOfMsg();
+	handlerState.operational = true;
+
+	return true;
+}
+
+void Handler::close()
+{
+	for (auto& connection : connections)
+		::close(connection->fd);
+	connections.clear();
+	handlerState.metrics["connections"] = 0;
+
+	if (listenFd < 0)
+		return;
+
+	::close(listenFd);
+	listenFd = -1;
+
+	logger.info() << "Stopped listening on port " << config.getPort() << endOfMsg();
+	handlerState.operational = false;
+}
+
+bool Handler::isReadable(const Connection& connection) const
+{
+	// further requests are not read while responses pile up, this limits pipelining
+	return !connection.closing && connection.outputData.length() < std::size_t(config.getMaxRequestSize());
+}
+
+long Handler::collectFds(fd_set* readFds, fd_set* writeFds, fd_set* excpFds, int* maxFd)
+{
+	if (listenFd == -1)
+		return -1;
+
+	if (int(connections.size()) < config.getMaxConnections())
+	{
+		FD_SET(listenFd, readFds);
+		*maxFd = std::max(*maxFd, listenFd);
+	}
+
+	// the next idle timeout determines when the handler has to be called
+	long timeout = -1;
+	auto now = Stopwatch::Clock::now();
+	for (auto& connection : connections)
+	{
+		if (isReadable(*connection))
+			FD_SET(connection->fd, readFds);
+		if (connection->outputData.length())
+			FD_SET(connection->fd, writeFds);
+		*maxFd = std::max(*maxFd, connection->fd);
+
+		long remainingMs = std::chrono::duration_cast<std::chrono::milliseconds>(connection->lastActivity + config.getIdleTimeout() - now).count();
+		timeout = timeout == -1 ? std::max(0L, remainingMs) : std::max(0L, std::min(timeout, remainingMs));
+	}
+
+	return timeout;
+}
+
+Events Handler::receive(const Items& items)
+{
+	try
+	{
+		return receiveX();
+	}
+	catch (const std::exception& ex)
+	{
+		handlerState.errorCounter++;
+
+		logger.error() << ex.what() << endOfMsg();
+	}
+
+	close();
+	return Events();
+}
+
+Events Handler::receiveX()
+{
+	Events events;
+
+	// try to open the listening socket
+	if (!open())
+		return events;
+
+	acceptConnections();
+
+	auto now = Stopwatch::Clock::now();
+	for (auto connectionPos = connections.begin(); connectionPos != connections.end();)
+	{
+		auto& connection = **connectionPos;
+
+		// errors only affect the connection on which they occur
+		bool closeConnection = false;
+		try
+		{
+			// read and answer all complete requests
+			bool eof = false;
+			if (isReadable(connection) && connection.inputData.readFrom(connection.fd, eof))
+			{
+				connection.lastActivity = now;
+				processRequests(connection, events);
+			}
+
+			// a client which has half-closed the connection still gets the pending responses
+			if (eof)
+				connection.closing = true;
+
+			writeData(connection);
+
+			closeConnection = (connection.closing && connection.outputData.empty())
+				|| connection.lastActivity + config.getIdleTimeout() <= now;
+		}
+		catch (const std::exception& ex)
+		{
+			handlerState.errorCounter++;
+
+			logger.error() << "Connection from " << connection.peer << ": " << ex.what() << endOfMsg();
+			closeConnection = true;
+		}
+
+		if (closeConnection)
+		{
+			if (config.getLogRequests())
+				logger.debug() << "Connection from " << connection.peer << " closed" << endOfMsg();
+
+			::close(connection.fd);
+			connectionPos = connections.erase(connectionPos);
+		}
+		else
+			connectionPos++;
+	}
+
+	handlerState.metrics["connections"] = connections.size();
+
+	return events;
+}
+
+void Handler::acceptConnections()
+{
+	while (int(connections.size()) < config.getMaxConnections())
+	{
+		sockaddr_storage addr;
+		socklen_t addrLen = sizeof(addr);
+		int fd = accept4(listenFd, reinterpret_cast<sockaddr*>(&addr), &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1)
+		{
+			if (errno == EWOULDBLOCK || errno == EAGAIN)
+				break;
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			logger.errorX() << unixError("accept4") << endOfMsg();
+		}
+
+		char host[NI_MAXHOST], service[NI_MAXSERV];
+		string peer = "unknown peer";
+		if (getnameinfo(reinterpret_cast<sockaddr*>(&addr), addrLen, host, sizeof(host), service, sizeof(service), NI_NUMERICHOST | NI_NUMERICSERV) == 0)
+			peer = string(host) + ":" + service;
+
+		if (config.getLogRequests())
+			logger.debug() << "Connection from " << peer << " accepted" << endOfMsg();
+
+		connections.push_back(std::make_unique<Connection>(fd, peer));
+	}
+}
+
+void Handler::processRequests(Connection& connection, Events& events)
+{
+	std::size_t maxRequestSize = config.getMaxRequestSize();
+
+	// requests are parsed in place, pipelined requests are answered in order
+	std::string_view data = connection.inputData.view();
+	while (!connection.closing)
+	{
+		// complete header available?
+		auto headerEnd = data.find("\r\n\r\n");
+		if (headerEnd == std::string_view::npos)
+		{
+			if (data.length() > maxRequestSize)
+				respond(connection, 431, true);
+			break;
+		}
+		std::string_view header = data.substr(0, headerEnd);
+
+		// analyze request line
+		auto lineEnd = std::min(header.find("\r\n"), header.length());
+		std::string_view requestLine = header.substr(0, lineEnd);
+		auto methodEnd = requestLine.find(' ');
+		auto targetEnd = requestLine.rfind(' ');
+		if (methodEnd == std::string_view::npos || targetEnd == methodEnd)
+		{
+			respond(connection, 400, true);
+			break;
+		}
+		std::string_view method = requestLine.substr(0, methodEnd);
+		std::string_view target = requestLine.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+		std::string_view version = requestLine.substr(targetEnd + 1);
+		if (version != "HTTP/1.1" && version != "HTTP/1.0")
+		{
+			respond(connection, 400, true);
+			break;
+		}
+
+		// analyze header fields
+		std::size_t contentLength = 0;
+		bool hasContentLength = false;
+		bool keepAlive = version == "HTTP/1.1";
+		int status = 0;
+		for (auto pos = lineEnd; pos < header.length();)
+		{
+			pos += 2;
+			auto fieldEnd = std::min(header.find("\r\n", pos), header.length());
+			std::string_view field = header.substr(pos, fieldEnd - pos);
+			pos = fieldEnd;
+
+			auto colon = field.find(':');
+			if (colon == std::string_view::npos)
+			{
+				status = 400;
+				break;
+			}
+			std::string_view name = field.substr(0, colon);
+			std::string_view value = trim(field.substr(colon + 1));
+
+			if (equalsIgnoreCase(name, "Content-Length"))
+			{
+				std::size_t length = 0;
+				auto [end, ec] = std::from_chars(value.data(), value.data() + value.length(), length);
+				if (ec != std::errc() || end != value.data() + value.length() || (hasContentLength && length != contentLength))
+					status = 400;
+				contentLength = length;
+				hasContentLength = true;
+			}
+			else if (equalsIgnoreCase(name, "Transfer-Encoding"))
+				// only bodies with a content length are supported
+				status = 501;
+			else if (equalsIgnoreCase(name, "Connection"))
+			{
+				if (equalsIgnoreCase(value, "close"))
+					keepAlive = false;
+				else if (equalsIgnoreCase(value, "keep-alive"))
+					keepAlive = true;
+			}
+		}
+		// compared without adding to the header size, a huge content length must not wrap around
+		if (!status && headerEnd + 4 > maxRequestSize)
+			status = 431;
+		if (!status && (contentLength > maxRequestSize || contentLength > maxRequestSize - (headerEnd + 4)))
+			status = 413;
+		if (status)
+		{
+			respond(connection, status, true);
+			break;
+		}
+
+		// complete body available?
+		std::size_t requestSize = headerEnd + 4 + contentLength;
+		if (data.length() < requestSize)
+			break;
+		std::string_view body = data.substr(headerEnd + 4, contentLength);
+
+		if (config.getLogRequests())
+			logger.debug() << "Request " << method << " " << target << " from " << connection.peer
+			               << " with body '" << body << "'" << endOfMsg();
+		handlerState.metrics["requests"]++;
+
+		respond(connection, dispatchRequest(method, target, body, events), !keepAlive);
+
+		// discard processed request
+		connection.inputData.consume(requestSize);
+		data.remove_prefix(requestSize);
+	}
+
+	// data following a request which closes the connection is ignored
+	if (connection.closing)
+		connection.inputData.clear();
+}
+
+int Handler::dispatchRequest(std::string_view method, std::string_view target, std::string_view body, Events& events)
+{
+	auto queryPos = target.find('?');
+	std::string_view path = target.substr(0, queryPos);
+	std::string_view query = queryPos != std::string_view::npos ? target.substr(queryPos + 1) : std::string_view();
+
+	int status = 404;
+	for (auto& [itemId, binding] : config.getBindings())
+		if (binding.path == path)
+		{
+			if (binding.method.length() && binding.method != method)
+			{
+				if (status == 404)
+					status = 405;
+				continue;
+			}
+
+			// extract value
+			string data(binding.fromQuery ? query : body);
+			if (binding.hasPattern)
+			{
+				std::smatch match;
+				if (!std::regex_search(data, match, binding.pattern) || match.size() != 2)
+				{
+					logger.warn() << "Data '" << data << "' for item " << itemId << " does not match pattern" << endOfMsg();
+					if (status != 200)
+						status = 400;
+					continue;
+				}
+				data = match[1];
+			}
+
+			status = 200;
+			events.add(Event(id, itemId, binding.eventType, Value::newString(data)));
+		}
+
+	return status;
+}
+
+void Handler::respond(Connection& connection, int status, bool close)
+{
+	connection.outputData += "HTTP/1.1 " + cnvToStr(status) + " " + getReasonPhrase(status) + "\r\n"
+		"Content-Length: 0\r\n" + (close ? "Connection: close\r\n" : "") + "\r\n";
+	if (close)
+		connection.closing = true;
+
+	if (status != 200)
+		logger.warn() << "Request from " << connection.peer << " answered with status " << status << endOfMsg();
+}
+
+void Handler::writeData(Connection& connection)
+{
+	while (connection.outputData.length())
+	{
+		ssize_t rc = ::send(connection.fd, connection.outputData.data(), connection.outputData.length(), MSG_NOSIGNAL);
+		if (rc == -1)
+		{
+			if (errno == EWOULDBLOCK || errno == EAGAIN)
+				return;
+			if (errno == EINTR)
+				continue;
+			Error() << unixError("send") << endOfMsg();
+		}
+		connection.outputData.erase(0, rc);
+	}
+}
+
+}
@@ -0,0 +1,119 @@
+#ifndef HTTPSERVER_H
+#define HTTPSERVER_H
+
+#include <regex>
+#include <memory>
+
+#include "link.h"
+#include "streambuffer.h"
+#include "udp.h"
+#include "logger.h"
+
+namespace httpserver
+{
+
+class Config
+{
+public:
+	struct Binding
+	{
+		string itemId;
+		// Request path (without query) addressing the item.
+		string path;
+		// Request method, any method is accepted if empty.
+		string method;
+		// STATE_IND or WRITE_REQ.
+		EventType eventType;
+		// The value is taken from the query instead of the body.
+		bool fromQuery;
+		// If given the first group of this regular expression becomes the value instead of the whole data.
+		bool hasPattern;
+		std::regex pattern;
+		Binding(string itemId, string path, string method, EventType eventType, bool fromQuery, bool hasPattern, std::regex pattern) :
+			itemId(itemId), path(path), method(method), eventType(eventType), fromQuery(fromQuery),
+			hasPattern(hasPattern), pattern(pattern) {}
+	};
+	class Bindings: public std::map<string, Binding>
+	{
+	public:
+		void add(Binding binding) { insert(value_type(binding.itemId, binding)); }
+	};
+
+private:
+	// Local address on which the server listens, 0.0.0.0 for all interfaces.
+	IpAddr localIpAddr;
+	int port;
+	int maxConnections;
+	// Keep-alive connections without any traffic for this time span are closed.
+	Seconds idleTimeout;
+	// Maximum size of a request including header and body.
+	int maxRequestSize;
+	Seconds reopenInterval;
+	bool logRequests;
+	Bindings bindings;
+
+public:
+	Config(IpAddr localIpAddr, int port, int maxConnections, Seconds idleTimeout, int maxRequestSize, Seconds reopenInterval, bool logRequests, Bindings bindings) :
+		localIpAddr(localIpAddr), port(port), maxConnections(maxConnections), idleTimeout(idleTimeout), maxRequestSize(maxRequestSize),
+		reopenInterval(reopenInterval), logRequests(logRequests), bindings(bindings) {}
+	IpAddr getLocalIpAddr() const { return localIpAddr; }
+	int getPort() const { return port; }
+	int getMaxConnections() const { return maxConnections; }
+	Seconds getIdleTimeout() const { return idleTimeout; }
+	int getMaxRequestSize() const { return maxRequestSize; }
+	Seconds getReopenInterval() const { return reopenInterval; }
+	bool getLogRequests() const { return logRequests; }
+	const Bindings& getBindings() const { return bindings; }
+};
+
+// Non-blocking HTTP/1.1 server which turns requests pushed by external systems (e.g. webhooks) into
+// events. Connections are kept alive and pipelined requests are answered in order.
+class Handler: public HandlerIf
+{
+private:
+	struct Connection
+	{
+		int fd;
+		// Address and port of the client.
+		string peer;
+		StreamBuffer inputData;
+		// Responses not yet accepted by the socket.
+		string outputData;
+		Stopwatch::Clock::time_point lastActivity;
+		// The connection is closed once the pending responses are written.
+		bool closing;
+		Connection(int fd, string peer) : fd(fd), peer(peer), lastActivity(Stopwatch::Clock::now()), closing(false) {}
+	};
+
+	string id;
+	Config config;
+	Logger logger;
+	int listenFd;
+	std::time_t lastOpenTry;
+	std::vector<std::unique_ptr<Connection>> connections;
+	HandlerState handlerState;
+
+public:
+	Handler(string id, Config config, Logger logger);
+	virtual ~Handler();
+	virtual void validate(Items& items) override;
+	virtual HandlerState getState() const override { return handlerState; }
+	virtual long collectFds(fd_set* readFds, fd_set* writeFds, fd_set* excpFds, int* maxFd) override;
+	virtual Events receive(const Items& items) override;
+	virtual Events send(const Items& items, const Events& events) override { return Events(); }
+
+private:
+	bool open();
+	void close();
+	Events receiveX();
+	void acceptConnections();
+	bool isReadable(const Connection& connection) const;
+	void processRequests(Connection& connection, Events& events);
+	int dispatchRequest(std::string_view method, std::string_view target, std::string_view body, Events& events);
+	void respond(Connection& connection, int status, bool close);
+	void writeData(Connection& connection);
+};
+
+}
+
+#endif
@@ -5,21 +5,59 @@
 #include <iomanip>
 #include <cstdint>
 #include <limits>
+#include <algorithm>
+#include <cmath>
 
 #include "knx.h"
 #include "finally.h"
 
-string IpAddr::toStr() const
+// Byte offsets of the fields within the KNXnet/IP frames. Offsets are counted from the start of
+// the frame, i.e. including the header.
+struct HeaderLayout
 {
-	in_addr addr;
-	addr.s_addr = htonl(value);
-	return inet_ntoa(addr);
-}
-
-bool IpAddr::fromStr(string ipStr, IpAddr& ip)
+	static constexpr int headerLength = 0;
+	static constexpr int version = 1;
+	static constexpr int serviceType = 2;
+	static constexpr int totalLength = 4;
+	static constexpr int size = 6;
+};
+
+// CONNECTION RESPONSE, CONNECTION STATE RESPONSE, DISCONNECT REQUEST and DISCONNECT RESPONSE
+struct ConnLayout
+{
+	static constexpr int channelId = 6;
+	static constexpr int status = 7;
+	static constexpr int hpaiLength = 8;
+	static constexpr int hpaiProtocol = 9;
+	static constexpr int hpaiIpAddr = 10;
+	static constexpr int hpaiIpPort = 14;
+	static constexpr int physicalAddr = 18;
+	static constexpr int connRespSize = 20;
+};
+
+// TUNNEL REQUEST and TUNNEL ACK
+struct TunnelLayout
+{
+	static constexpr int channelId = 7;
+	static constexpr int seqNo = 8;
+	static constexpr int status = 9;
+	static constexpr int ackSize = 10;
+};
+
+// cEMI frame within TUNNEL REQUEST (without additional information)
+struct CemiLayout
 {
-	ip = ntohl(inet_addr(ipStr.c_str()));
-	return ip != INADDR_NONE;
+	static constexpr int msgCode = 10;
+	static constexpr int srcAddr = 14;
+	static constexpr int destAddr = 16;
+	static constexpr int apduLength = 18;
+	static constexpr int apdu = 20;
+	static constexpr int minSize = 20;
+};
+
+ByteView getApdu(ByteView msg)
+{
+	return msg.substr(CemiLayout::apdu, msg[CemiLayout::apduLength]);
 }
 
 string ServiceType::toStr() const
@@ -59,201 +97,6 @@ string MsgCode::toStr() const
 		return "?0x" + cnvToHexStr(value) + "?";
 }
 
-const DatapointType DPT_1_001(1, 1, "on/off");
-const DatapointType DPT_5_001(5, 1, "%");
-const DatapointType DPT_5_004(5, 4, "%");
-const DatapointType DPT_7_013(7, 13, "lux");
-const DatapointType DPT_9_001(9, 1, "C");
-const DatapointType DPT_9_004(9, 4, "lux");
-const DatapointType DPT_13_013(13, 13, "kWh");
-const DatapointType DPT_14_056(13, 13, "W");
-
-string DatapointType::toStr() const
-{
-	std::ostringstream stream;
-	stream << mainNo << '.' << std::setw(3) << std::setfill('0') << subNo;
-	return stream.str();
-}
-
-bool DatapointType::fromStr(string dptStr, DatapointType& dpt)
-{
-	try
-	{
-		string::size_type pos = dptStr.find('.');
-		if (pos == 0 || pos == string::npos)
-			return false;
-	
-		int mainNo = std::stoi(dptStr.substr(0, pos));
-		if (mainNo < 0 || mainNo > 999)
-			return false;
-		int subNo = std::stoi(dptStr.substr(pos + 1));
-		if (subNo < 0 || subNo > 999)
-			return false;
-		
-		dpt = DatapointType(mainNo, subNo, "?");
-		
-		return true;
-	}
-	catch (const std::invalid_argument&)
-	{
-		return false;
-	}
-}
-
-ByteString DatapointType::exportValue(const Value& value) const
-{
-	if (!value.isBoolean() && !value.isVoid() && !value.isNumber())
-		return ByteString();
-		
-	if (mainNo == 1)
-	{
-		bool b = value.isBoolean() ? value.getBoolean() : (value.isNumber() ? value.getNumber() > 0 : true);
-		return b ? ByteString({0x01}) : ByteString({0x00});
-	}
-	else
-	{
-		double d = value.isBoolean() ? value.getBoolean() : (value.isNumber() ? value.getNumber() : 1);
-		if (mainNo == 5 && subNo == 1)
-		{
-			if (d >= 0 && d <= 100)
-			{
-				uint8_t b = d * 255.0 / 100.0;
-				return ByteString({0x00, b});
-			}
-		}
-		else if (mainNo == 5)
-		{
-			if (d >= 0 && d <= 255)
-			{
-				uint8_t i = d;
-				return ByteString({0x00, i});
-			}
-		}
-		else if (mainNo == 7)
-		{
-			if (d >= 0 && d <= 65535)
-			{
-				uint16_t i = d;
-				Byte bytes[3];
-				bytes[0] = 0x00;
-				bytes[1] = (i >> 8) & 0xFF;
-				bytes[2] = i & 0xFF;
-				return ByteString(bytes, sizeof(bytes));
-			}
-		}
-		else if (mainNo == 9)
-		{
-//			uint32_t E = 0;
-//			while ((d < -20.48 || d > 20.47) && E <= 15) { d = d / 2.0; E++; }
-//			if (d >= -20.48 && d <= 20.47)
-//			{
-//				uint32_t M = d * 100.0;
-//				cout << "PEW: " << M << endl;
-//				Byte bytes[3];
-//				bytes[0] = 0x00;
-//				bytes[1] = ((M >> 24) & 0x80) | (E << 3) | ((M >> 8) & 0x07);
-//				bytes[2] = M & 0xFF;
-//				return ByteString(bytes, sizeof(bytes));
-//			}
-			int32_t E = 0;
-			int32_t M = d * 100.0;
-			while ((M < -2048 || M > 2047) && E <= 15) { M >>= 1; E++; }
-			if (M >= -2048 && M <= 2047)
-			{
-				Byte bytes[3];
-				bytes[0] = 0x00;
-				bytes[1] = ((M >> 24) & 0x80) | (E << 3) | ((M >> 8) & 0x07);
-				bytes[2] = M & 0xFF;
-				return ByteString(bytes, sizeof(bytes));
-			}
-		}
-		else if (mainNo == 12 || mainNo == 13)
-		{
-			uint32_t i = d;
-			Byte bytes[5];
-			bytes[0] = 0x00;
-			bytes[1] = (i >> 24) & 0xFF;
-			bytes[2] = (i >> 16) & 0xFF;
-			bytes[3] = (i >> 8) & 0xFF;
-			bytes[4] = i & 0xFF;
-			return ByteString(bytes, sizeof(bytes));
-		}
-		else if (mainNo == 14)
-		{
-			static_assert(sizeof(uint32_t) == sizeof(float), "uint32_t and float do not have the same size");
-			static_assert(std::numeric_limits<float>::is_iec559, "float is not IEEE-754 encoded");
-
-			union { float f; uint32_t i; } u; 
-			u.f = d;
-			Byte bytes[5];
-			bytes[0] = 0x00;
-			bytes[1] = (u.i >> 24) & 0xFF;
-			bytes[2] = (u.i >> 16) & 0xFF;
-			bytes[3] = (u.i >> 8) & 0xFF;
-			bytes[4] = u.i & 0xFF;
-			return ByteString(bytes, sizeof(bytes));
-		}
-		else if (mainNo == 17)
-		{
-			if (d >= 0 && d <= 63)
-			{
-				uint8_t i = d;
-				return ByteString({0x00, i});
-			}
-		}
-		else if (mainNo == 20)
-		{
-			uint8_t i = d;
-			return ByteString({0x00, i});
-		}
-	}
-	return ByteString();
-}
-
-Value DatapointType::importValue(ByteString bytes) const
-{
-	if (mainNo == 1 && bytes.length() == 1)
-		return Value::newBoolean((bytes[0] & 0x01) == 0x01);
-	else if (mainNo == 5 && subNo == 1 && bytes.length() == 2)
-		return Value::newNumber(bytes[1] * 100.0 / 255.0);
-	else if (mainNo == 5 && bytes.length() == 2)
-		return Value::newNumber(1.0 * bytes[1]);
-	else if (mainNo == 7 && bytes.length() == 3)
-		return Value::newNumber(1.0 * (bytes[1] << 8 | bytes[2]));
-	else if (mainNo == 9)
-	{
-		int32_t E = (bytes[1] >> 3) & 0x0F;
-		int32_t M = (bytes[1] & 0x07) << 8 | bytes[2];
-		if (bytes[1] & 0x80)
-			return Value::newNumber(((2048 - M) << E) / -100.0);
-		else
-			return Value::newNumber((M << E) / 100.0);
-	}
-	else if (mainNo == 12 && bytes.length() == 5)
-		return Value::newNumber(1.0 * (bytes[1] << 24 | bytes[2] << 16 | bytes[3] << 8 | bytes[4]));
-	else if (mainNo == 13 && bytes.length() == 5)
-		return Value::newNumber(1.0 * (bytes[1] << 24 | bytes[2] << 16 | bytes[3] << 8 | bytes[4]));
-	else if (mainNo == 14 && bytes.length() == 5)
-	{
-		// assumption: float is encoded in IEEE 754 floating point format
-		assert(sizeof(uint32_t) == sizeof(float));
-		union { float f; uint32_t i; } u; 
-		u.i = bytes[1] << 24 | bytes[2] << 16 | bytes[3] << 8 | bytes[4];
-		return Value::newNumber(u.f);
-	}
-	else if (mainNo == 16)
-	{
-		auto pos = bytes.find_last_not_of('\0');
-		if (pos != ByteString::npos)
-			return Value::newString(cnvToAsciiStr(bytes.substr(1, pos)));
-	}
-	else if (mainNo == 17 && bytes.length() == 2)
-		return Value::newNumber(1.0 * bytes[1]);
-	else if (mainNo == 20 && bytes.length() == 2)
-		return Value::newNumber(1.0 * bytes[1]);
-	return Value();
-}
-
 string GroupAddr::toStr() const
 {
 	if (null)
@@ -330,14 +173,24 @@ bool PhysicalAddr::fromStr(string paStr, PhysicalAddr& pa)
 }
 
 KnxHandler::KnxHandler(string _id, KnxConfig _config, Logger _logger) : 
-	id(_id), config(_config), logger(_logger), state(DISCONNECTED)
+	id(_id), config(_config), logger(_logger), nextReceivedLDataInd(0),
+	readReqDeadlines(config.getBindings().size()), expiredReadReqs(0),
+	busLoad(0), ldataConRtt(0), minLDataConRtt(0)
 {
 	handlerState.errorCounter = 0;
+	handlerState.metrics["pendingReadReqs"] = 0;
+	handlerState.metrics["expiredReadReqs"] = 0;
+	handlerState.metrics["busLoad"] = 0;
+
+	int no = 1;
+	for (auto& tunnel : config.getTunnels())
+		tunnels.emplace_back(new Tunnel(no++, tunnel.ipAddr, tunnel.ipPort));
 }
 
 KnxHandler::~KnxHandler() 
 { 
-	disconnect();
+	for (auto& tunnel : tunnels)
+		disconnect(*tunnel);
 }
 
 void KnxHandler::validate(Items& items)
@@ -353,146 +206,288 @@ void KnxHandler::validate(Items& items)
 		auto& item = items.validate(itemId);
 		if (item.getOwnerId() == id)
 			item.setWritable(!binding.writeGa.isNull());
+
+		if (!binding.dpt.isSupported())
+			throw std::runtime_error("DPT " + binding.dpt.toStr() + " of item " + itemId + " is not supported by link " + id);
+		Unit unit = binding.dpt.getUnit();
+		if (unit != Unit::UNKNOWN && item.getUnit() != Unit::UNKNOWN && !unit.canConvertTo(item.getUnit()))
+			logger.warn() << "Unit " << unit.toStr() << " of DPT " << binding.dpt.toStr() << " does not match unit " 
+			              << item.getUnit().toStr() << " of item " << itemId << endOfMsg();
 	}
 }
 
-void KnxHandler::close()
+void KnxHandler::close(Tunnel& tunnel)
 {
-	if (state == DISCONNECTED)
+	if (tunnel.state == DISCONNECTED)
 		return;
 
-	if (state == CONNECTED)
+	// L_Data.req messages not yet acknowledged by the gateway are taken over by the remaining tunnels
+	std::list<LDataReq> ldataReqs;
+	if (tunnel.state == CONNECTED)
 	{
-		lastConnectTry.setToNull();
+		tunnel.lastConnectTry.setToNull();
+
+		if (!tunnel.lastTunnelReqSendTime.isNull())
+			ldataReqs.push_back(tunnel.lastSentLDataReq);
+		for (auto& waitingLDataReqs : tunnel.waitingLDataReqs)
+			ldataReqs.splice(ldataReqs.end(), waitingLDataReqs);
+		tunnel.sentLDataReqs.clear();
 
-		logger.info() << "Disconnected from KNX/IP gateway " << config.getIpAddr().toStr() << ":" << config.getIpPort() << endOfMsg();
+		logger.info() << "Disconnected from KNX/IP gateway " << tunnel.ipAddr.toStr() << ":" << tunnel.ipPort 
+		              << " (tunnel " << tunnel.no << ")" << endOfMsg();
 	}
 	else
-		lastConnectTry = Clock::now();
+		tunnel.lastConnectTry = Clock::now();
+
+	tunnel.socket.close();
+	tunnel.state = DISCONNECTED;
+	updateState();
 
-	::close(socket);
-	state = DISCONNECTED;
+	if (ldataReqs.size())
+	{
+		if (handlerState.operational)
+			logger.warn() << "Moving " << ldataReqs.size() << " L_Data.req from tunnel " << tunnel.no << " to other tunnels" << endOfMsg();
+		for (auto& ldataReq : ldataReqs)
+			addLDataReq(ldataReq);
+	}
 }
 
-void KnxHandler::disconnect()
+void KnxHandler::disconnect(Tunnel& tunnel)
 {
-	if (state == CONNECTED)
-		sendControlMsg(createDiscReq());
+	if (tunnel.state == CONNECTED)
+	{
+		createDiscReq(tunnel, newControlMsg(tunnel));
+		flushMsgs(tunnel);
+	}
+
+	close(tunnel);
+}
 
-	close();
+void KnxHandler::updateState()
+{
+	handlerState.operational = false;
+	for (auto& tunnel : tunnels)
+		if (tunnel->state == CONNECTED)
+			handlerState.operational = true;
 }
 
 long KnxHandler::collectFds(fd_set* readFds, fd_set* writeFds, fd_set* excpFds, int* maxFd)
 {
-	if (state != DISCONNECTED)
+	for (auto& tunnel : tunnels)
+		if (tunnel->state != DISCONNECTED)
+		{
+			FD_SET(tunnel->socket.getFd(), readFds);
+			*maxFd = std::max(*maxFd, tunnel->socket.getFd());
+		}
+
+	// wake up for the next READ_REQ deadline or paced L_Data.req
+	TimePoint wakeUpTime;
+	if (!readReqQueue.empty())
+		wakeUpTime = readReqDeadlines[readReqQueue.front()];
+	for (auto& tunnel : tunnels)
+		if (  tunnel->state == CONNECTED
+		   && (tunnel->waitingLDataReqs[HIGH_PRIORITY].size() || tunnel->waitingLDataReqs[LOW_PRIORITY].size())
+		   && (wakeUpTime.isNull() || nextLDataReqTime < wakeUpTime)
+		   )
+			wakeUpTime = nextLDataReqTime;
+	if (wakeUpTime.isNull())
+		return -1;
+	auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(wakeUpTime - Clock::now());
+	return std::max(long(timeout.count()), 0L);
+}
+
+void KnxHandler::addReadReq(const KnxConfig::Binding& binding)
+{
+	// a STATE_IND answers all READ_REQ events received so far, so the deadline of the first
+	// one applies
+	TimePoint& deadline = readReqDeadlines[binding.handle];
+	if (!deadline.isNull())
+		return;
+
+	deadline = Clock::now() + config.getReadResponseWindow();
+	readReqQueue.push_back(binding.handle);
+	handlerState.metrics["pendingReadReqs"] = readReqQueue.size();
+}
+
+bool KnxHandler::removeReadReq(const KnxConfig::Binding& binding)
+{
+	TimePoint& deadline = readReqDeadlines[binding.handle];
+	// expired READ_REQ events are left to processExpiredReadReqs()
+	if (deadline.isNull() || deadline <= Clock::now())
+		return false;
+
+	deadline.setToNull();
+	readReqQueue.erase(std::find(readReqQueue.begin(), readReqQueue.end(), binding.handle));
+	handlerState.metrics["pendingReadReqs"] = readReqQueue.size();
+	return true;
+}
+
+void KnxHandler::processExpiredReadReqs()
+{
+	TimePoint now = Clock::now();
+
+	while (!readReqQueue.empty() && readReqDeadlines[readReqQueue.front()] <= now)
 	{
-		FD_SET(socket, readFds);
-		*maxFd = std::max(*maxFd, socket);
+		readReqDeadlines[readReqQueue.front()].setToNull();
+		readReqQueue.pop_front();
+		expiredReadReqs++;
 	}
 
-	return -1;
+	handlerState.metrics["pendingReadReqs"] = readReqQueue.size();
+	handlerState.metrics["expiredReadReqs"] = expiredReadReqs;
 }
 
-Events KnxHandler::receive(const Items& items)
+// Time constant of the exponential decay of the bus load.
+static const Clock::duration busLoadPeriod = 2s;
+
+// Returns the time the bus is occupied by a telegram with an APDU of the passed length.
+static Clock::duration getTelegramDuration(int dataLength)
 {
-	try
+	// A standard TP1 frame consists of 7 octets plus APDU, each transmitted as 13 bits
+	// (including parity, stop bit and pause) at 9600 bit/s. It is preceded by at least 50 bit
+	// times of idle bus and followed by 15 bit times and the acknowledge octet.
+	long bits = (7 + dataLength) * 13 + 50 + 15 + 13;
+	return std::chrono::microseconds(bits * 1000000 / 9600);
+}
+
+void KnxHandler::addBusLoad(ByteView data)
+{
+	Clock::duration duration = getTelegramDuration(data.length());
+	busLoad = getBusLoad(Clock::now()) + double(duration.count()) / busLoadPeriod.count();
+}
+
+double KnxHandler::getBusLoad(TimePoint now)
+{
+	if (now > busLoadTime)
 	{
-		return receiveX(items);
+		busLoad *= std::exp(-double((now - busLoadTime).count()) / busLoadPeriod.count());
+		busLoadTime = now;
 	}
-	catch (const std::exception& ex)
-	{
-		handlerState.errorCounter++;
+	return busLoad;
+}
 
-		logger.error() << ex.what() << endOfMsg();
+void KnxHandler::updateLDataConRtt(Clock::duration rtt)
+{
+	if (ldataConRtt == Clock::duration::zero())
+		ldataConRtt = minLDataConRtt = rtt;
+	else
+	{
+		ldataConRtt = (ldataConRtt * 7 + rtt) / 8;
+		minLDataConRtt = std::min(minLDataConRtt, rtt);
 	}
-
-	disconnect();
-	return Events();
 }
 
-Events KnxHandler::receiveX(const Items& items)
+void KnxHandler::paceLDataReqs(const LDataReq& ldataReq)
 {
 	TimePoint now = Clock::now();
 
+	// on its own our traffic stays below the maximum bus load, the gap is widened by the
+	// load exceeding it
+	double maxBusLoad = config.getMaxBusLoad() / 100.0;
+	double factor = std::max(getBusLoad(now), maxBusLoad) / (maxBusLoad * maxBusLoad);
+	Clock::duration pause = std::chrono::duration_cast<Clock::duration>(getTelegramDuration(ldataReq.dataLength) * factor);
+
+	// gateway is queuing, therefore wait for the L_Data.con
+	if (ldataConRtt > minLDataConRtt * 4)
+		pause = std::max(pause, ldataConRtt);
+
+	nextLDataReqTime = now + pause;
+}
+
+Events KnxHandler::receive(const Items& items)
+{
 	Events events;
 
-	if (state == DISCONNECTED)
+	processExpiredReadReqs();
+	handlerState.metrics["busLoad"] = std::round(getBusLoad(Clock::now()) * 100);
+
+	for (auto& tunnel : tunnels)
 	{
-		if (lastConnectTry + config.getReconnectInterval() > now)
-			return events;
-		lastConnectTry = now;
-
-		socket = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
-		if (socket == -1)
-			logger.errorX() << unixError("socket") << endOfMsg();
-		auto autoClose = finally([this] { ::close(socket); state = DISCONNECTED; });
-
-		sockaddr_in localAddr;
-		localAddr.sin_family = AF_INET;
-		localAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-		localAddr.sin_port = 0;
-		int rc = bind(socket, reinterpret_cast<sockaddr*>(&localAddr), sizeof(localAddr));
-		if (rc == -1)
-			logger.errorX() << unixError("bind") << endOfMsg();
-
-		socklen_t localAddrLen = sizeof(localAddr);
-		rc = getsockname(socket, reinterpret_cast<sockaddr*>(&localAddr), &localAddrLen);
-		if (rc == -1)
-			logger.errorX() << unixError("getsockname") << endOfMsg();
-		localIpPort = ntohs(localAddr.sin_port);
-
-		logger.debug() << "Using port " << localIpPort << " as local control and data endpoint " << endOfMsg();
+		try
+		{
+			receiveX(*tunnel, items, events);
+			continue;
+		}
+		catch (const std::exception& ex)
+		{
+			handlerState.errorCounter++;
+
+			logger.error() << ex.what() << endOfMsg();
+		}
+
+		disconnect(*tunnel);
+	}
+
+	return events;
+}
+
+void KnxHandler::receiveX(Tunnel& tunnel, const Items& items, Events& events)
+{
+	TimePoint now = Clock::now();
+
+	if (tunnel.state == DISCONNECTED)
+	{
+		if (tunnel.lastConnectTry + config.getReconnectInterval() > now)
+			return;
+		tunnel.lastConnectTry = now;
+
+		tunnel.socket.open();
+		auto autoClose = finally([&tunnel] { tunnel.socket.close(); tunnel.state = DISCONNECTED; });
+		tunnel.localIpPort = tunnel.socket.getLocalPort();
+
+		logger.debug() << "Using port " << tunnel.localIpPort << " as local control and data endpoint for tunnel " << tunnel.no << endOfMsg();
 		if (config.getNatMode())
 			logger.debug() << "Using NAT mode" << endOfMsg();
 
-		sendControlMsg(createConnReq());
+		createConnReq(tunnel, newControlMsg(tunnel));
+		flushMsgs(tunnel);
 
-		state = WAIT_FOR_CONN_RESP;
-		lastControlReqSendTime = now;
+		tunnel.state = WAIT_FOR_CONN_RESP;
+		tunnel.lastControlReqSendTime = now;
 		autoClose.disable();
 	}
-	else if (state == CONNECTED)
+	else if (tunnel.state == CONNECTED)
 	{
-		if (ongoingConnStateReq && lastControlReqSendTime + config.getControlRespTimeout() <= now)
-			logger.errorX() << "CONNECTION STATE REQUEST not answered in time" << endOfMsg();
+		if (tunnel.ongoingConnStateReq && tunnel.lastControlReqSendTime + config.getControlRespTimeout() <= now)
+			logger.errorX() << "CONNECTION STATE REQUEST not answered in time (tunnel " << tunnel.no << ")" << endOfMsg();
 
-		if (!ongoingConnStateReq && lastControlReqSendTime + config.getConnStateReqInterval() <= now)
+		if (!tunnel.ongoingConnStateReq && tunnel.lastControlReqSendTime + config.getConnStateReqInterval() <= now)
 		{
-			lastControlReqSendTime = now;
-			ongoingConnStateReq = true;
-			sendControlMsg(createConnStateReq());
+			tunnel.lastControlReqSendTime = now;
+			tunnel.ongoingConnStateReq = true;
+			createConnStateReq(tunnel, newControlMsg(tunnel));
 		}
 
-		processPendingTunnelAck();
-		processPendingLDataCons();
+		processPendingTunnelAck(tunnel);
+		processPendingLDataCons(tunnel);
 	}
-	else if (state == WAIT_FOR_CONN_RESP)
+	else if (tunnel.state == WAIT_FOR_CONN_RESP)
 	{
-		if (lastControlReqSendTime + config.getControlRespTimeout() <= now)
-			logger.errorX() << "CONNECTION REQUEST not answered in time" << endOfMsg();
+		if (tunnel.lastControlReqSendTime + config.getControlRespTimeout() <= now)
+			logger.errorX() << "CONNECTION REQUEST not answered in time (tunnel " << tunnel.no << ")" << endOfMsg();
 	}
 
-	ByteString msg;
+	ByteView msg;
 	IpAddr senderIpAddr;
 	IpPort senderIpPort;
-	while (state != DISCONNECTED && receiveMsg(msg, senderIpAddr, senderIpPort))
+	while (tunnel.state != DISCONNECTED && receiveMsg(tunnel, msg, senderIpAddr, senderIpPort))
 	{
 		checkMsg(msg);
 
-		ServiceType serviceType(msg[2], msg[3]);
-		if (state == CONNECTED && serviceType == ServiceType::TUNNEL_REQ)
+		ServiceType serviceType(msg[HeaderLayout::serviceType], msg[HeaderLayout::serviceType + 1]);
+		if (tunnel.state == CONNECTED && serviceType == ServiceType::TUNNEL_REQ)
 		{
-			checkTunnelReq(msg);
+			checkTunnelReq(msg, tunnel.channelId);
 			logTunnelReq(msg, true);
 
-			Byte seqNo = msg[8];
-			Byte expectedSeqNo = (lastReceivedSeqNo + 1) & 0xFF;
-			if (seqNo == lastReceivedSeqNo)
+			Byte seqNo = msg[TunnelLayout::seqNo];
+			Byte expectedSeqNo = (tunnel.lastReceivedSeqNo + 1) & 0xFF;
+			if (seqNo == tunnel.lastReceivedSeqNo)
 			{
 				logger.warn() << "Received TUNNEL REQUEST has last sequence number 0x" << cnvToHexStr(seqNo)
 				              << " (expected: 0x" << cnvToHexStr(expectedSeqNo) << ")" << endOfMsg();
 
-				sendDataMsg(createTunnelAck(seqNo));
+				createTunnelAck(tunnel, newDataMsg(tunnel), seqNo);
 				continue;
 			}
 			if (seqNo != expectedSeqNo)
@@ -500,89 +495,97 @@ Events KnxHandler::receiveX(const Items& items)
 				logger.warn() << "Received TUNNEL REQUEST has invalid sequence number 0x" << cnvToHexStr(seqNo)
 				              << " (expected: 0x" << cnvToHexStr(expectedSeqNo) << ")" << endOfMsg();
 
-//				lastReceivedSeqNo = seqNo;
+//				tunnel.lastReceivedSeqNo = seqNo;
 				continue;
 			}
-			lastReceivedSeqNo = seqNo;
-			sendDataMsg(createTunnelAck(seqNo));
+			tunnel.lastReceivedSeqNo = seqNo;
+			createTunnelAck(tunnel, newDataMsg(tunnel), seqNo);
 
-			MsgCode msgCode = msg[10];
+			MsgCode msgCode = msg[CemiLayout::msgCode];
 			if (msgCode == MsgCode::LDATA_IND)
-				processReceivedLDataInd(msg, items, events);
+				processReceivedLDataInd(tunnel, msg, items, events);
 			else if (msgCode == MsgCode::LDATA_CON)
-				processReceivedLDataCon(msg);
+				processReceivedLDataCon(tunnel, msg);
 			else
 				logger.warn() << "Received TUNNEL REQUEST has unknown message code 0x" + cnvToHexStr(msgCode) << endOfMsg();
 		}
-		else if (state == CONNECTED && serviceType == ServiceType::TUNNEL_ACK)
+		else if (tunnel.state == CONNECTED && serviceType == ServiceType::TUNNEL_ACK)
 		{
 			checkTunnelAck(msg);
 
-			processReceivedTunnelAck(msg);
+			processReceivedTunnelAck(tunnel, msg);
 		}
-		else if (state == CONNECTED && serviceType == ServiceType::CONN_STATE_RESP && ongoingConnStateReq)
+		else if (tunnel.state == CONNECTED && serviceType == ServiceType::CONN_STATE_RESP && tunnel.ongoingConnStateReq)
 		{
-			checkConnStateResp(msg, channelId);
+			checkConnStateResp(msg, tunnel.channelId);
 
-			ongoingConnStateReq = false;
+			tunnel.ongoingConnStateReq = false;
 		}
-		else if (state == WAIT_FOR_CONN_RESP && serviceType == ServiceType::CONN_RESP)
+		else if (tunnel.state == WAIT_FOR_CONN_RESP && serviceType == ServiceType::CONN_RESP)
 		{
 			checkConnResp(msg);
 
-			channelId = msg[6];
-			dataIpAddr = IpAddr(msg[10], msg[11], msg[12], msg[13]);
-			dataIpPort = IpPort(msg[14] << 8 | msg[15]);
-			if (config.getNatMode() && (dataIpAddr == 0 || dataIpPort == 0))
+			tunnel.channelId = msg[ConnLayout::channelId];
+			const Byte* hpaiIpAddr = &msg[ConnLayout::hpaiIpAddr];
+			tunnel.dataIpAddr = IpAddr(hpaiIpAddr[0], hpaiIpAddr[1], hpaiIpAddr[2], hpaiIpAddr[3]);
+			tunnel.dataIpPort = IpPort(msg[ConnLayout::hpaiIpPort] << 8 | msg[ConnLayout::hpaiIpPort + 1]);
+			if (config.getNatMode() && (tunnel.dataIpAddr == 0 || tunnel.dataIpPort == 0))
 			{
-				dataIpPort = senderIpPort;
-				dataIpAddr = senderIpAddr;
+				tunnel.dataIpPort = senderIpPort;
+				tunnel.dataIpAddr = senderIpAddr;
 			}
-			if (msg[18] != 0 || msg[19] != 0)
-				physicalAddr = PhysicalAddr(msg[18], msg[19]);
+			PhysicalAddr receivedPhysicalAddr(msg[ConnLayout::physicalAddr], msg[ConnLayout::physicalAddr + 1]);
+			if (receivedPhysicalAddr.value != 0)
+				tunnel.physicalAddr = receivedPhysicalAddr;
 			else
-				physicalAddr = config.getPhysicalAddr();
-
-			state = CONNECTED;
-			ongoingConnStateReq = false;
-			waitingLDataReqs.clear();
-			sentLDataReqs.clear();
-			lastReceivedSeqNo = 0xFF;
-			lastSentSeqNo = 0xFF;
-			lastTunnelReqSendTime.setToNull();
-			receivedReadReqs.clear();
-
-			logger.debug() << "Using channel 0x" << cnvToHexStr(channelId) << endOfMsg();
-			logger.debug() << "Using " << dataIpAddr.toStr() << ":" << dataIpPort << " as remote data endpoint" << endOfMsg();
-			logger.info() << "Connected to KNX/IP gateway " << config.getIpAddr().toStr() << ":" << config.getIpPort()
-			              << " with physical address " << physicalAddr.toStr() << endOfMsg();
+				tunnel.physicalAddr = config.getPhysicalAddr();
+
+			tunnel.state = CONNECTED;
+			tunnel.ongoingConnStateReq = false;
+			for (auto& waitingLDataReqs : tunnel.waitingLDataReqs)
+				waitingLDataReqs.clear();
+			tunnel.sentLDataReqs.clear();
+			tunnel.lastReceivedSeqNo = 0xFF;
+			tunnel.lastSentSeqNo = 0xFF;
+			tunnel.lastTunnelReqSendTime.setToNull();
+			updateState();
+
+			logger.debug() << "Using channel 0x" << cnvToHexStr(tunnel.channelId) << endOfMsg();
+			logger.debug() << "Using " << tunnel.dataIpAddr.toStr() << ":" << tunnel.dataIpPort << " as remote data endpoint" << endOfMsg();
+			logger.info() << "Connected to KNX/IP gateway " << tunnel.ipAddr.toStr() << ":" << tunnel.ipPort
+			              << " with physical address " << tunnel.physicalAddr.toStr() << " (tunnel " << tunnel.no << ")" << endOfMsg();
 		}
-		else if (state == CONNECTED && serviceType == ServiceType::DISC_REQ)
+		else if (tunnel.state == CONNECTED && serviceType == ServiceType::DISC_REQ)
 		{
-			logger.error() << "Received DISCONNECT REQUEST" << endOfMsg();
+			logger.error() << "Received DISCONNECT REQUEST (tunnel " << tunnel.no << ")" << endOfMsg();
 
-			sendControlMsg(createDiscResp());
+			createDiscResp(tunnel, newControlMsg(tunnel));
+			flushMsgs(tunnel);
 			handlerState.errorCounter++;
-			close();
+			close(tunnel);
 		}
 		else
 			logger.warn() << "Received unexpected message with service type " << serviceType.toStr() << endOfMsg();
 	}
 
-	if (state == CONNECTED)
-		processWaitingLDataReqs();
+	if (tunnel.state == CONNECTED)
+		processWaitingLDataReqs(tunnel);
 
-	return events;
+	// send all TUNNEL ACKs, TUNNEL REQUESTs and control messages collected in this iteration at once
+	if (tunnel.state != DISCONNECTED)
+		flushMsgs(tunnel);
 }
 
 Events KnxHandler::send(const Items& items, const Events& events)
 {
-	if (state != CONNECTED)
+	if (!handlerState.operational)
 		return Events();
 
+	// sendX() only queues the telegrams, so an error does not affect the tunnel connections
+	Events newEvents;
 	try
 	{
-		return sendX(items, events);
+		newEvents = sendX(items, events);
 	}
 	catch (const std::exception& ex)
 	{
@@ -591,8 +594,28 @@ Events KnxHandler::send(const Items& items, const Events& events)
 		logger.error() << ex.what() << endOfMsg();
 	}
 
-	disconnect();
-	return Events();
+	for (auto& tunnel : tunnels)
+	{
+		if (tunnel->state != CONNECTED)
+			continue;
+
+		try
+		{
+			processWaitingLDataReqs(*tunnel);
+			flushMsgs(*tunnel);
+			continue;
+		}
+		catch (const std::exception& ex)
+		{
+			handlerState.errorCounter++;
+
+			logger.error() << ex.what() << endOfMsg();
+		}
+
+		disconnect(*tunnel);
+	}
+
+	return newEvents;
 }
 
 Events KnxHandler::sendX(const Items& items, const Events& events)
@@ -611,15 +634,19 @@ Events KnxHandler::sendX(const Items& items, const Events& events)
 			const Value& value = event.getValue();
 
 			// create data/APDU for L_Data.req
-			ByteString data;
+			Byte data[DatapointType::maxDataLength];
+			int dataLength;
 			if (event.getType() == EventType::READ_REQ)
-				data = ByteString({0x00});
+			{
+				data[0] = 0x00;
+				dataLength = 1;
+			}
 			else
 			{
 				assert(event.getType() == EventType::WRITE_REQ || event.getType() == EventType::STATE_IND);
 
-				data = binding.dpt.exportValue(value);
-				if (!data.length())
+				dataLength = binding.dpt.exportValue(value, data);
+				if (!dataLength)
 				{
 					logger.error() << "Event value '" << value.toStr()
 					               << "' (type " << value.getType().toStr() << ") of item " << itemId
@@ -630,57 +657,123 @@ Events KnxHandler::sendX(const Items& items, const Events& events)
 					data[0] |= 0x80;
 				else // STATE_IND
 				{
-					auto pos = receivedReadReqs.find(event.getItemId());
-					if (pos != receivedReadReqs.end())
-					{
+					if (removeReadReq(binding))
 						data[0] |= 0x40;
-						receivedReadReqs.erase(pos);
-					}
 					else
 						data[0] |= 0x80;
 				}
 			}
 
 			// send L-Data.req
+			ByteView apdu(data, dataLength);
 			if (event.getType() == EventType::READ_REQ && owner)
 			{
 				if (!binding.stateGa.isNull())
-					waitingLDataReqs.emplace_back(itemId, binding.stateGa, data);
+					addLDataReq(LDataReq(itemId, binding.stateGa, apdu, LOW_PRIORITY));
 				else if (!binding.writeGa.isNull())
-					waitingLDataReqs.emplace_back(itemId, binding.writeGa, data);
+					addLDataReq(LDataReq(itemId, binding.writeGa, apdu, LOW_PRIORITY));
 			}
 			else if (event.getType() == EventType::STATE_IND && !owner && !binding.stateGa.isNull())
-				waitingLDataReqs.emplace_back(itemId, binding.stateGa, data);
+				addLDataReq(LDataReq(itemId, binding.stateGa, apdu, HIGH_PRIORITY));
 			else if (event.getType() == EventType::WRITE_REQ && owner && !binding.writeGa.isNull())
-				waitingLDataReqs.emplace_back(itemId, binding.writeGa, data);
+				addLDataReq(LDataReq(itemId, binding.writeGa, apdu, HIGH_PRIORITY));
 		}
 	}
 
-	processWaitingLDataReqs();
-
 	return Events();
 }
 
-void KnxHandler::sendTunnelReq(const LDataReq& ldataReq, Byte seqNo)
+KnxHandler::Tunnel* KnxHandler::selectTunnel(GroupAddr ga)
 {
-	ByteString msg = createTunnelReq(seqNo, ldataReq.ga, ldataReq.data);
-	sendDataMsg(msg);
-	logTunnelReq(msg, false);
-	lastTunnelReqSendTime = Clock::now();
+	// the same GA is always assigned to the same tunnel as long as the set of connected
+	// tunnels does not change, which preserves the order of its telegrams
+	int count = 0;
+	for (auto& tunnel : tunnels)
+		if (tunnel->state == CONNECTED)
+			count++;
+	if (!count)
+		return nullptr;
+
+	int index = ga.value % count;
+	for (auto& tunnel : tunnels)
+		if (tunnel->state == CONNECTED && index-- == 0)
+			return tunnel.get();
+	return nullptr;
 }
 
-void KnxHandler::sendLDataReq(const LDataReq& ldataReq)
+void KnxHandler::addLDataReq(const LDataReq& ldataReq)
 {
-	lastSentSeqNo = (lastSentSeqNo + 1) & 0xFF;
-	lastSentLDataReq = ldataReq;
-	lastTunnelReqSendAttempts = 0;
-	sendTunnelReq(lastSentLDataReq, lastSentSeqNo);
+	if (Tunnel* tunnel = selectTunnel(ldataReq.ga); tunnel)
+		tunnel->waitingLDataReqs[ldataReq.priority].push_back(ldataReq);
+	else
+		logger.warn() << "L_Data.req for GA " << ldataReq.ga.toStr() << " discarded since no tunnel is connected (Item " 
+		              << ldataReq.itemId << ")" << endOfMsg();
+}
+
+bool KnxHandler::isDuplicate(const Tunnel& tunnel, PhysicalAddr pa, GroupAddr ga, ByteView data)
+{
+	TimePoint now = Clock::now();
+	unsigned tunnelBit = 1u << (tunnel.no - 1);
+
+	// the oldest matching telegram which has not yet been delivered by this tunnel is the original
+	for (int i = 0; i < maxReceivedLDataInds; i++)
+	{
+		auto& ind = receivedLDataInds[(nextReceivedLDataInd + i) % maxReceivedLDataInds];
+		if (  ind.time + 1s > now && !(ind.tunnelMask & tunnelBit)
+		   && ind.pa == pa && ind.ga == ga && ind.getData() == data
+		   )
+		{
+			ind.tunnelMask |= tunnelBit;
+			return true;
+		}
+	}
+
+	auto& ind = receivedLDataInds[nextReceivedLDataInd];
+	nextReceivedLDataInd = (nextReceivedLDataInd + 1) % maxReceivedLDataInds;
+	ind.time = now;
+	ind.pa = pa;
+	ind.ga = ga;
+	ind.dataLength = data.copy(ind.data, sizeof(ind.data));
+	ind.tunnelMask = tunnelBit;
+	return false;
 }
 
-void KnxHandler::processReceivedLDataInd(ByteString msg, const Items& items, Events& events)
+void KnxHandler::sendTunnelReq(Tunnel& tunnel, const LDataReq& ldataReq, Byte seqNo)
 {
-	GroupAddr ga(msg[16], msg[17]);
-	ByteString data = msg.substr(20, msg[18]);
+	UdpSocket::Msg& msg = newDataMsg(tunnel);
+	createTunnelReq(tunnel, msg, seqNo, ldataReq.ga, ldataReq.getData());
+	logTunnelReq(ByteView(msg.data, msg.length), false);
+	tunnel.lastTunnelReqSendTime = Clock::now();
+}
+
+void KnxHandler::sendLDataReq(Tunnel& tunnel, const LDataReq& ldataReq)
+{
+	tunnel.lastSentSeqNo = (tunnel.lastSentSeqNo + 1) & 0xFF;
+	tunnel.lastSentLDataReq = ldataReq;
+	tunnel.lastTunnelReqSendAttempts = 0;
+	sendTunnelReq(tunnel, tunnel.lastSentLDataReq, tunnel.lastSentSeqNo);
+	if (config.getMaxBusLoad() < 100)
+		paceLDataReqs(ldataReq);
+}
+
+void KnxHandler::processReceivedLDataInd(Tunnel& tunnel, ByteView msg, const Items& items, Events& events)
+{
+	PhysicalAddr pa(msg[CemiLayout::srcAddr], msg[CemiLayout::srcAddr + 1]);
+	GroupAddr ga(msg[CemiLayout::destAddr], msg[CemiLayout::destAddr + 1]);
+	ByteView data = getApdu(msg);
+
+	if (tunnels.size() > 1)
+	{
+		// telegrams sent by this link via another tunnel
+		for (auto& otherTunnel : tunnels)
+			if (otherTunnel->state == CONNECTED && otherTunnel->physicalAddr == pa)
+				return;
+
+		if (isDuplicate(tunnel, pa, ga, data))
+			return;
+	}
+
+	addBusLoad(data);
 
 	for (auto& bindingPair : config.getBindings())
 	{
@@ -693,7 +786,7 @@ void KnxHandler::processReceivedLDataInd(ByteString msg, const Items& items, Eve
 				if (!owner)
 				{
 					events.add(Event(id, binding.itemId, EventType::READ_REQ, Value()));
-					receivedReadReqs.insert(binding.itemId);
+					addReadReq(binding);
 				}
 			}
 			else
@@ -711,15 +804,17 @@ void KnxHandler::processReceivedLDataInd(ByteString msg, const Items& items, Eve
 	}
 }
 
-void KnxHandler::processReceivedLDataCon(ByteString msg)
+void KnxHandler::processReceivedLDataCon(Tunnel& tunnel, ByteView msg)
 {
-	GroupAddr ga(msg[16], msg[17]);
-	ByteString data = msg.substr(20, msg[18]);
+	GroupAddr ga(msg[CemiLayout::destAddr], msg[CemiLayout::destAddr + 1]);
+	ByteView data = getApdu(msg);
 
-	for (auto pos = sentLDataReqs.begin(); pos != sentLDataReqs.end(); pos++)
-		if (pos->ldataReq.ga == ga && pos->ldataReq.data == data)
+	for (auto pos = tunnel.sentLDataReqs.begin(); pos != tunnel.sentLDataReqs.end(); pos++)
+		if (pos->ldataReq.ga == ga && pos->ldataReq.getData() == data)
 		{
-			sentLDataReqs.erase(pos);
+			addBusLoad(data);
+			updateLDataConRtt(Clock::now() - pos->time);
+			tunnel.sentLDataReqs.erase(pos);
 			return;
 		}
 
@@ -727,46 +822,46 @@ void KnxHandler::processReceivedLDataCon(ByteString msg)
 	              << " received (Item " << getItemId(ga) << ")" << endOfMsg();
 }
 
-void KnxHandler::processReceivedTunnelAck(ByteString msg)
+void KnxHandler::processReceivedTunnelAck(Tunnel& tunnel, ByteView msg)
 {
-	if (!lastTunnelReqSendTime.isNull() && lastSentSeqNo == msg[8])
+	if (!tunnel.lastTunnelReqSendTime.isNull() && tunnel.lastSentSeqNo == msg[TunnelLayout::seqNo])
 	{
-		sentLDataReqs.emplace_back(lastSentLDataReq, Clock::now());
-		lastTunnelReqSendTime.setToNull();
+		tunnel.sentLDataReqs.emplace_back(tunnel.lastSentLDataReq, Clock::now());
+		tunnel.lastTunnelReqSendTime.setToNull();
 		return;
 	}
 
 	logger.warn() << "Received unexpected TUNNEL ACQ with sequence number 0x"
-	              << cnvToHexStr(msg[8]) << endOfMsg();
+	              << cnvToHexStr(msg[TunnelLayout::seqNo]) << endOfMsg();
 }
 
-void KnxHandler::processPendingTunnelAck()
+void KnxHandler::processPendingTunnelAck(Tunnel& tunnel)
 {
-	if (lastTunnelReqSendTime.isNull())
+	if (tunnel.lastTunnelReqSendTime.isNull())
 		return;
 
-	if (lastTunnelReqSendTime + config.getTunnelAckTimeout() > Clock::now())
+	if (tunnel.lastTunnelReqSendTime + config.getTunnelAckTimeout() > Clock::now())
 		return;
 
-	if (lastTunnelReqSendAttempts > 0)
-		logger.errorX() << "Second TUNNEL REQUEST with sequence number 0x" << cnvToHexStr(lastSentSeqNo)
-		                << " for GA " << lastSentLDataReq.ga.toStr()
-		                << " was not acknowledged in time (Item " << lastSentLDataReq.itemId << ")" << endOfMsg();
+	if (tunnel.lastTunnelReqSendAttempts > 0)
+		logger.errorX() << "Second TUNNEL REQUEST with sequence number 0x" << cnvToHexStr(tunnel.lastSentSeqNo)
+		                << " for GA " << tunnel.lastSentLDataReq.ga.toStr()
+		                << " was not acknowledged in time (Item " << tunnel.lastSentLDataReq.itemId << ")" << endOfMsg();
 
 
-	logger.warn() << "First TUNNEL REQUEST with sequence number 0x" << cnvToHexStr(lastSentSeqNo)
-	              << " for GA " << lastSentLDataReq.ga.toStr()
-	              << " was not acknowledged in time (Item " << lastSentLDataReq.itemId << ")" << endOfMsg();
+	logger.warn() << "First TUNNEL REQUEST with sequence number 0x" << cnvToHexStr(tunnel.lastSentSeqNo)
+	              << " for GA " << tunnel.lastSentLDataReq.ga.toStr()
+	              << " was not acknowledged in time (Item " << tunnel.lastSentLDataReq.itemId << ")" << endOfMsg();
 
-	sendTunnelReq(lastSentLDataReq, lastSentSeqNo);
-	lastTunnelReqSendAttempts++;
+	sendTunnelReq(tunnel, tunnel.lastSentLDataReq, tunnel.lastSentSeqNo);
+	tunnel.lastTunnelReqSendAttempts++;
 }
 
-void KnxHandler::processPendingLDataCons()
+void KnxHandler::processPendingLDataCons(Tunnel& tunnel)
 {
 	TimePoint now = Clock::now();
 
-	for (auto pos = sentLDataReqs.begin(); pos != sentLDataReqs.end();)
+	for (auto pos = tunnel.sentLDataReqs.begin(); pos != tunnel.sentLDataReqs.end();)
 		if (pos->time + config.getLDataConTimeout() <= now)
 		{
 			LDataReq& ldataReq = pos->ldataReq;
@@ -774,7 +869,7 @@ void KnxHandler::processPendingLDataCons()
 			if (ldataReq.attempts == 0)
 			{
 				ldataReq.attempts++;
-				waitingLDataReqs.push_front(ldataReq);
+				tunnel.waitingLDataReqs[ldataReq.priority].push_front(ldataReq);
 
 				logger.warn() << "First L_Data.req for GA " << ldataReq.ga.toStr()
 				              << " was not confirmed in time (Item " << ldataReq.itemId << ")" << endOfMsg();
@@ -786,101 +881,93 @@ void KnxHandler::processPendingLDataCons()
 				logger.error() << "Second L_Data.req for GA " << ldataReq.ga.toStr()
 				               << " was not confirmed in time (Item " << ldataReq.itemId << ")" << endOfMsg();
 			}
-			pos = sentLDataReqs.erase(pos);
+			pos = tunnel.sentLDataReqs.erase(pos);
 		}
 		else
 			pos++;
 }
 
-void KnxHandler::processWaitingLDataReqs()
+void KnxHandler::processWaitingLDataReqs(Tunnel& tunnel)
 {
-	if (  state != CONNECTED
-	   || !lastTunnelReqSendTime.isNull()
-	   || sentLDataReqs.size() > 4
+	if (  tunnel.state != CONNECTED
+	   || !tunnel.lastTunnelReqSendTime.isNull()
+	   || tunnel.sentLDataReqs.size() > 4
+	   || nextLDataReqTime > Clock::now()
 	   )
 		return;
 
-	for (auto pos1 = waitingLDataReqs.begin(); pos1 != waitingLDataReqs.end(); pos1++)
-	{
-		auto pos2 = sentLDataReqs.begin();
-		while (pos2 != sentLDataReqs.end() && pos1->ga != pos2->ldataReq.ga)
-			pos2++;
-		if (pos2 == sentLDataReqs.end())
+	for (auto& waitingLDataReqs : tunnel.waitingLDataReqs)
+		for (auto pos1 = waitingLDataReqs.begin(); pos1 != waitingLDataReqs.end(); pos1++)
 		{
-			sendLDataReq(*pos1);
-			waitingLDataReqs.erase(pos1);
-			return;
+			auto pos2 = tunnel.sentLDataReqs.begin();
+			while (pos2 != tunnel.sentLDataReqs.end() && pos1->ga != pos2->ldataReq.ga)
+				pos2++;
+			if (pos2 == tunnel.sentLDataReqs.end())
+			{
+				sendLDataReq(tunnel, *pos1);
+				waitingLDataReqs.erase(pos1);
+				return;
+			}
 		}
-	}
 }
 
-bool KnxHandler::receiveMsg(ByteString& msg, IpAddr& addr, IpPort& port) const
+bool KnxHandler::receiveMsg(Tunnel& tunnel, ByteView& msg, IpAddr& addr, IpPort& port)
 {
-	Byte buffer[1024];
-	sockaddr_in sockAddr;
-	socklen_t sockAddrLen = sizeof(sockAddr);
-	int rc = ::recvfrom(socket, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&sockAddr), &sockAddrLen);
-	if (rc == -1)
-		if (errno == EWOULDBLOCK || errno == EAGAIN)
-			return false;
-		else
-			logger.errorX() << unixError("recvFrom") << endOfMsg();
-	if (rc == 0)
-		logger.errorX() << "Message size 0 returned by recvFrom()" << endOfMsg();
-
-	if (sockAddrLen != sizeof(sockAddr))
-		logger.errorX() << "Address returned by recvFrom() has unexpected size" << endOfMsg();
-	if (sockAddr.sin_family != AF_INET)
-		logger.errorX() << "Address returned by recvFrom() does not belong to family AF_INET" << endOfMsg();
-	addr = IpAddr(ntohl(sockAddr.sin_addr.s_addr));
-	port = ntohs(sockAddr.sin_port);
-	msg = ByteString(buffer, rc);
+	UdpSocket::Msg receivedMsg;
+	if (!tunnel.socket.receiveMsg(receivedMsg))
+		return false;
+	if (receivedMsg.length == 0)
+		logger.errorX() << "Message size 0 returned by recvmmsg()" << endOfMsg();
+
+	addr = receivedMsg.addr;
+	port = receivedMsg.port;
+	msg = ByteView(receivedMsg.data, receivedMsg.length);
 
 	logMsg(msg, true);
 
 	return true;
 }
 
-void KnxHandler::sendMsg(IpAddr addr, IpPort port, ByteString msg) const
+UdpSocket::Msg& KnxHandler::newControlMsg(Tunnel& tunnel)
 {
-	sockaddr_in sockAddr;
-	sockAddr.sin_family = AF_INET;
-	sockAddr.sin_addr.s_addr = htonl(addr);
-	sockAddr.sin_port = htons(port);
-	int rc = ::sendto(socket, msg.data(), msg.length(), 0, reinterpret_cast<sockaddr*>(&sockAddr), sizeof(sockAddr));
-	if (rc == -1)
-		logger.errorX() << unixError("sendto") << endOfMsg();
-	if (rc != msg.length())
-		logger.errorX() << "Message size returned by sendTo() differs from the passed one" << endOfMsg();
-
-	logMsg(msg, false);
+	if (tunnel.socket.isSendQueueFull())
+		flushMsgs(tunnel);
+	return tunnel.socket.newMsg(tunnel.ipAddr, tunnel.ipPort);
 }
 
-void KnxHandler::sendControlMsg(ByteString msg) const
+UdpSocket::Msg& KnxHandler::newDataMsg(Tunnel& tunnel)
 {
-	sendMsg(config.getIpAddr(), config.getIpPort(), msg);
+	if (tunnel.socket.isSendQueueFull())
+		flushMsgs(tunnel);
+	return tunnel.socket.newMsg(tunnel.dataIpAddr, tunnel.dataIpPort);
 }
 
-void KnxHandler::sendDataMsg(ByteString msg) const
+void KnxHandler::flushMsgs(Tunnel& tunnel)
 {
-	sendMsg(dataIpAddr, dataIpPort, msg);
+	if (config.getLogRawMsg())
+		for (int i = 0; i < tunnel.socket.getQueuedMsgCount(); i++)
+		{
+			const UdpSocket::Msg& msg = tunnel.socket.getQueuedMsg(i);
+			logMsg(ByteView(msg.data, msg.length), false);
+		}
+
+	tunnel.socket.flush();
 }
 
-ByteString addHeader(ServiceType type, ByteString body)
+int addHeader(Byte* msg, ServiceType type, int bodyLength)
 {
-	Byte header[6];
-	header[0] = 0x06; 								// Header length (6 bytes)
-	header[1] = 0x10; 								// KNXnet/IP version 1.0 
-	header[2] = type.high();						// Hi-byte Service type descriptor
-	header[3] = type.low();							// Lo-byte Service type descriptor
-	header[4] = (body.length() + 6) >> 8 & 0xFF;	// Hi-byte total length
-	header[5] = (body.length() + 6) & 0xFF; 		// Lo-byte total length
-	return ByteString(header, sizeof(header)) + body;
+	int totalLength = HeaderLayout::size + bodyLength;
+	msg[HeaderLayout::headerLength] = HeaderLayout::size;
+	msg[HeaderLayout::version] = 0x10; 								// KNXnet/IP version 1.0 
+	msg[HeaderLayout::serviceType] = type.high();					// Hi-byte Service type descriptor
+	msg[HeaderLayout::serviceType + 1] = type.low();				// Lo-byte Service type descriptor
+	msg[HeaderLayout::totalLength] = totalLength >> 8 & 0xFF;		// Hi-byte total length
+	msg[HeaderLayout::totalLength + 1] = totalLength & 0xFF;		// Lo-byte total length
+	return totalLength;
 }
 
-ByteString createHpai(IpAddr addr, IpPort port)
+int addHpai(Byte* hpai, IpAddr addr, IpPort port)
 {
-	Byte hpai[8];
 	hpai[0] = 0x08; 				// Host protocol address information (HPAI) length 
 	hpai[1] = 0x01;					// Host protocol code (0x01 = IPV4_UDP, 0x02 = IPV6_TCP
 	hpai[2] = addr.highHigh();
@@ -889,37 +976,36 @@ ByteString createHpai(IpAddr addr, IpPort port)
 	hpai[5] = addr.lowLow();
 	hpai[6] = port >> 8 & 0xFF;		// Hi-byte port
 	hpai[7] = port & 0xFF;			// Lo-byte port
-	return ByteString(hpai, sizeof(hpai));
+	return 8;
 }
 
-ByteString createCRI()
+int addCri(Byte* cri)
 {
-	Byte cri[4];
 	cri[0] = 0x04;			// Length (4 bytes)
 	cri[1] = 0x04;			// Tunnel Connection
 	cri[2] = 0x02;			// KNX Layer (Tunnel Link Layer)
 	cri[3] = 0x00;			// Reserved
-	return ByteString(cri, sizeof(cri));
+	return 4;
 }
 
-ByteString createTunnelHeader(Byte channelId, Byte seqNo)
+int addTunnelHeader(Byte* header, Byte channelId, Byte seqNo)
 {
-	Byte header[4];
 	header[0] = 0x04;		// Length
 	header[1] = channelId;
 	header[2] = seqNo;
 	header[3] = 0x00;		// Reserved
-	return ByteString(header, sizeof(header));
+	return 4;
 }
 
-ByteString createLongHpai(Byte channelId, IpAddr addr, IpPort port)
+int addLongHpai(Byte* longHpai, Byte channelId, IpAddr addr, IpPort port)
 {
-	return ByteString({channelId}) + ByteString({0x00}) + createHpai(addr, port);
+	longHpai[0] = channelId;
+	longHpai[1] = 0x00;		// Reserved
+	return 2 + addHpai(longHpai + 2, addr, port);
 }
 
-ByteString createCemiFrame(PhysicalAddr pa, GroupAddr ga, ByteString data)
+int addCemiFrame(Byte* frame, PhysicalAddr pa, GroupAddr ga, ByteView data)
 {
-	Byte frame[10];
 	frame[0] = MsgCode::LDATA_REQ;	// Message code
 	frame[1] = 0x00;				// Additional info length
 	frame[2] = 0x8C;				// Control byte
@@ -931,91 +1017,94 @@ ByteString createCemiFrame(PhysicalAddr pa, GroupAddr ga, ByteString data)
 	frame[8] = data.length();		// Data/APDU length 
 	frame[9] = 0x00;				// APDU, Transport protocol control information (TPCI)
 	//frame[10] = 0x80;               // APDU, Application protocol control information (APCI)
-	return ByteString(frame, sizeof(frame)) + data;
+	data.copy(frame + 10, data.length());
+	return 10 + data.length();
 }
 
-void KnxHandler::checkMsg(ByteString msg) const
+void KnxHandler::checkMsg(ByteView msg) const
 {
 	if (msg.length() < 8)
 		logger.errorX() << "Received message has length " << msg.length()
 		                << " - Expected: >=8" << endOfMsg();
-	ByteString header = msg.substr(0, 6);
-	if (header[0] != 0x06)
-		logger.errorX() << "Received message contains header length " << cnvToStr(int(header[0]))
+	if (msg[HeaderLayout::headerLength] != HeaderLayout::size)
+		logger.errorX() << "Received message contains header length " << cnvToStr(int(msg[HeaderLayout::headerLength]))
 		                << " - Expected: 6" << endOfMsg();
-	if (header[1] != 0x10)
-		logger.errorX() << "Received message has KNXnet/IP version 0x" << cnvToHexStr(header[1])
+	if (msg[HeaderLayout::version] != 0x10)
+		logger.errorX() << "Received message has KNXnet/IP version 0x" << cnvToHexStr(msg[HeaderLayout::version])
 		                << " - Expected: 0x10" << endOfMsg();
-	unsigned short totalLength = header[4] << 8 | header[5];
+	unsigned short totalLength = msg[HeaderLayout::totalLength] << 8 | msg[HeaderLayout::totalLength + 1];
 	if (totalLength != msg.length())
 		logger.errorX() << "Received message contains total length " << cnvToStr(totalLength)
 		                << " (actual length: " << msg.length() << ")" << endOfMsg();
 }
 
-void KnxHandler::checkTunnelReq(ByteString msg) const
+void KnxHandler::checkTunnelReq(ByteView msg, Byte channelId) const
 {
-	if (msg.length() < 20)
+	if (msg.length() < CemiLayout::minSize)
 		logger.errorX() << "Received TUNNEL REQUEST has length " << msg.length()
 		                << " - Expected: >=20" << endOfMsg();
-	Byte receivedChannelId = msg[7];
+	Byte receivedChannelId = msg[TunnelLayout::channelId];
 	if (receivedChannelId != channelId)
 		logger.errorX() << "Received TUNNEL REQUEST has channel id 0x" << cnvToHexStr(receivedChannelId)
 		                << " - Expected: 0x" << cnvToHexStr(channelId) << endOfMsg();
 }
 
-void KnxHandler::checkTunnelAck(ByteString msg) const
+void KnxHandler::checkTunnelAck(ByteView msg) const
 {
-	if (msg.length() != 10)
+	if (msg.length() != TunnelLayout::ackSize)
 		logger.errorX() << "Received TUNNEL ACK has length " << msg.length()
 		                << " - Expected: 10" << endOfMsg();
-	if (msg[9] != 0x00)
-		logger.errorX() << "Received TUNNEL ACK has status code 0x" << cnvToHexStr(msg[9])
-		                << " (" << getStatusCodeText(msg[9]) << ") - Expected: 0x00" << endOfMsg();
+	Byte status = msg[TunnelLayout::status];
+	if (status != 0x00)
+		logger.errorX() << "Received TUNNEL ACK has status code 0x" << cnvToHexStr(status)
+		                << " (" << getStatusCodeText(status) << ") - Expected: 0x00" << endOfMsg();
 }
 
-void KnxHandler::checkConnResp(ByteString msg) const
+void KnxHandler::checkConnResp(ByteView msg) const
 {
-	if (msg[7] != 0x00)
-		logger.errorX() << "Received CONNECTION RESPONSE has status code 0x" << cnvToHexStr(msg[7])
-		                << " (" << getStatusCodeText(msg[7]) << ") - Expected: 0x00" << endOfMsg();
-	if (msg.length() != 20)
+	Byte status = msg[ConnLayout::status];
+	if (status != 0x00)
+		logger.errorX() << "Received CONNECTION RESPONSE has status code 0x" << cnvToHexStr(status)
+		                << " (" << getStatusCodeText(status) << ") - Expected: 0x00" << endOfMsg();
+	if (msg.length() != ConnLayout::connRespSize)
 		logger.errorX() << "Received CONNECTION RESPONSE has length " << msg.length()
 		                << " - Expected: 20" << endOfMsg();
-	if (msg[8] != 0x08)
-		logger.errorX() << "Received CONNECTION RESPONSE has HPAI length " << cnvToStr(int(msg[8]))
+	if (msg[ConnLayout::hpaiLength] != 0x08)
+		logger.errorX() << "Received CONNECTION RESPONSE has HPAI length " << cnvToStr(int(msg[ConnLayout::hpaiLength]))
 		                << " - Expected: 8" << endOfMsg();
-	if (msg[9] != 0x01)
-		logger.errorX() << "Received CONNECTION RESPONSE has protocol code 0x" << cnvToHexStr(msg[9])
+	if (msg[ConnLayout::hpaiProtocol] != 0x01)
+		logger.errorX() << "Received CONNECTION RESPONSE has protocol code 0x" << cnvToHexStr(msg[ConnLayout::hpaiProtocol])
 		                << " - Expected: 0x01 (IPV4_UDP)" << endOfMsg();
 }
 
-void KnxHandler::checkConnStateResp(ByteString msg, Byte channelId) const
+void KnxHandler::checkConnStateResp(ByteView msg, Byte channelId) const
 {
-	if (msg[6] != channelId)
-		logger.errorX() << "Received CONNECTION STATE RESPONSE has channel id 0x" << cnvToHexStr(msg[6])
+	if (msg[ConnLayout::channelId] != channelId)
+		logger.errorX() << "Received CONNECTION STATE RESPONSE has channel id 0x" << cnvToHexStr(msg[ConnLayout::channelId])
 		                << " - Expected: 0x" << cnvToHexStr(channelId) << endOfMsg();
-	if (msg[7] != 0x00)
-		logger.errorX() << "Received CONNECTION STATE RESPONSE has status code 0x" << cnvToHexStr(msg[7])
-		                << " (" << getStatusCodeText(msg[7]) << ") - Expected: 0x00" << endOfMsg();
+	Byte status = msg[ConnLayout::status];
+	if (status != 0x00)
+		logger.errorX() << "Received CONNECTION STATE RESPONSE has status code 0x" << cnvToHexStr(status)
+		                << " (" << getStatusCodeText(status) << ") - Expected: 0x00" << endOfMsg();
 }
 
-void KnxHandler::logMsg(ByteString msg, bool received) const
+void KnxHandler::logMsg(ByteView msg, bool received) const
 {
-	if (config.getLogRawMsg() && msg.length() >= 4)
+	if (config.getLogRawMsg() && msg.length() >= HeaderLayout::size)
 	{
-		ServiceType type(msg[2], msg[3]);
+		ServiceType type(msg[HeaderLayout::serviceType], msg[HeaderLayout::serviceType + 1]);
 		logger.debug() << (received ? "R: " : "S: ") << cnvToHexStr(msg) << " (" << type.toStr() << ")" << endOfMsg();
 	}
 }
 
-void KnxHandler::logTunnelReq(ByteString msg, bool received) const
+void KnxHandler::logTunnelReq(ByteView msg, bool received) const
 {
-	if (config.getLogData() && msg.length() >= 20)
+	if (config.getLogData() && msg.length() >= CemiLayout::minSize)
 	{
-		PhysicalAddr pa(msg[14], msg[15]);
-		GroupAddr ga(msg[16], msg[17]);
-		MsgCode msgCode(msg[10]);
-		ByteString data(msg.substr(20, msg[18]));
+		PhysicalAddr pa(msg[CemiLayout::srcAddr], msg[CemiLayout::srcAddr + 1]);
+		GroupAddr ga(msg[CemiLayout::destAddr], msg[CemiLayout::destAddr + 1]);
+		MsgCode msgCode(msg[CemiLayout::msgCode]);
+		ByteView data = getApdu(msg);
 
 		string type = "?";
 		if (data.length() > 0)
@@ -1032,37 +1121,52 @@ void KnxHandler::logTunnelReq(ByteString msg, bool received) const
 	}
 }
 
-ByteString KnxHandler::createConnReq() const
+void KnxHandler::createConnReq(const Tunnel& tunnel, UdpSocket::Msg& msg) const
 {
-	ByteString hpai = config.getNatMode() ? createHpai(IpAddr(0), 0) : createHpai(config.getLocalIpAddr(), localIpPort);
-	return addHeader(ServiceType::CONN_REQ, hpai + hpai + createCRI());
+	IpAddr addr = config.getNatMode() ? IpAddr(0) : config.getLocalIpAddr();
+	IpPort port = config.getNatMode() ? 0 : tunnel.localIpPort;
+	Byte* body = msg.data + HeaderLayout::size;
+	int bodyLength = addHpai(body, addr, port);
+	bodyLength += addHpai(body + bodyLength, addr, port);
+	bodyLength += addCri(body + bodyLength);
+	msg.length = addHeader(msg.data, ServiceType::CONN_REQ, bodyLength);
 }
 
-ByteString KnxHandler::createConnStateReq() const
+void KnxHandler::createConnStateReq(const Tunnel& tunnel, UdpSocket::Msg& msg) const
 {
-	ByteString longHpai = config.getNatMode() ? createLongHpai(channelId, IpAddr(0), 0) : createLongHpai(channelId, config.getLocalIpAddr(), localIpPort);
-	return addHeader(ServiceType::CONN_STATE_REQ, longHpai);
+	IpAddr addr = config.getNatMode() ? IpAddr(0) : config.getLocalIpAddr();
+	IpPort port = config.getNatMode() ? 0 : tunnel.localIpPort;
+	int bodyLength = addLongHpai(msg.data + HeaderLayout::size, tunnel.channelId, addr, port);
+	msg.length = addHeader(msg.data, ServiceType::CONN_STATE_REQ, bodyLength);
 }
 
-ByteString KnxHandler::createDiscReq() const
+void KnxHandler::createDiscReq(const Tunnel& tunnel, UdpSocket::Msg& msg) const
 {
-	ByteString longHpai = config.getNatMode() ? createLongHpai(channelId, IpAddr(0), 0) : createLongHpai(channelId, config.getLocalIpAddr(), localIpPort);
-	return addHeader(ServiceType::DISC_REQ, longHpai);
+	IpAddr addr = config.getNatMode() ? IpAddr(0) : config.getLocalIpAddr();
+	IpPort port = config.getNatMode() ? 0 : tunnel.localIpPort;
+	int bodyLength = addLongHpai(msg.data + HeaderLayout::size, tunnel.channelId, addr, port);
+	msg.length = addHeader(msg.data, ServiceType::DISC_REQ, bodyLength);
 }
 
-ByteString KnxHandler::createDiscResp() const
+void KnxHandler::createDiscResp(const Tunnel& tunnel, UdpSocket::Msg& msg) const
 {
-	return addHeader(ServiceType::DISC_RESP, ByteString({channelId, 0x00}));
+	msg.data[ConnLayout::channelId] = tunnel.channelId;
+	msg.data[ConnLayout::status] = 0x00;
+	msg.length = addHeader(msg.data, ServiceType::DISC_RESP, 2);
 }
 
-ByteString KnxHandler::createTunnelReq(Byte seqNo, GroupAddr ga, ByteString data) const
+void KnxHandler::createTunnelReq(const Tunnel& tunnel, UdpSocket::Msg& msg, Byte seqNo, GroupAddr ga, ByteView data) const
 {
-	return addHeader(ServiceType::TUNNEL_REQ, createTunnelHeader(channelId, seqNo) + createCemiFrame(physicalAddr, ga, data));
+	Byte* body = msg.data + HeaderLayout::size;
+	int bodyLength = addTunnelHeader(body, tunnel.channelId, seqNo);
+	bodyLength += addCemiFrame(body + bodyLength, tunnel.physicalAddr, ga, data);
+	msg.length = addHeader(msg.data, ServiceType::TUNNEL_REQ, bodyLength);
 }
 
-ByteString KnxHandler::createTunnelAck(Byte seqNo) const
+void KnxHandler::createTunnelAck(const Tunnel& tunnel, UdpSocket::Msg& msg, Byte seqNo) const
 {
-	return addHeader(ServiceType::TUNNEL_ACK, createTunnelHeader(channelId, seqNo));
+	int bodyLength = addTunnelHeader(msg.data + HeaderLayout::size, tunnel.channelId, seqNo);
+	msg.length = addHeader(msg.data, ServiceType::TUNNEL_ACK, bodyLength);
 }
 
 string KnxHandler::getStatusCodeName(Byte statusCode) const
@@ -1,31 +1,14 @@
 #ifndef KNX_H
 #define KNX_H
 
-#include <set>
+#include <deque>
+#include <vector>
+#include <memory>
 
 #include "link.h"
 #include "logger.h"
-
-typedef unsigned short IpPort;
-
-struct IpAddr
-{
-	typedef unsigned long Value;
-	Value value;
-
-	IpAddr() : value(0) {}
-	IpAddr(Value _value) : value(_value) {}
-	IpAddr(Byte highHigh, Byte highLow, Byte lowHigh, Byte lowLow) : value(highHigh << 24 | highLow << 16 | lowHigh << 8 | lowLow) {}
-
-	Byte highHigh() const { return value >> 24 & 0xFF; }
-	Byte highLow() const { return value >> 16 & 0xFF; }
-	Byte lowHigh() const { return value >> 8 & 0xFF; }
-	Byte lowLow() const { return value & 0xFF; }
-
-	operator Value() const { return value; }
-	string toStr() const;
-	static bool fromStr(string ipStr, IpAddr& ip);
-};
+#include "udp.h"
+#include "dpt.h"
 
 struct ServiceType 
 {
@@ -66,22 +49,6 @@ struct MsgCode
 	static const Value LDATA_CON = 0x2E;
 };
 
-struct DatapointType
-{
-	int mainNo;
-	int subNo;
-	string unit;
-
-	DatapointType() : mainNo(0), subNo(0) {}
-	DatapointType(int _mainNo, int _subNo, string _unit) : mainNo(_mainNo), subNo(_subNo), unit(_unit) {}
-	
-	string toStr() const;
-	static bool fromStr(string dptStr, DatapointType& dpt);
-
-	ByteString exportValue(const Value& value) const;
-	Value importValue(ByteString bytes) const;
-};
-
 struct GroupAddr
 {
 	typedef unsigned short Value;
@@ -134,50 +101,61 @@ public:
 		GroupAddr stateGa;
 		GroupAddr writeGa;
 		DatapointType dpt;
+		int handle; // index of binding, assigned by Bindings::add()
 		Binding(string _itemId, GroupAddr _stateGa, GroupAddr _writeGa, DatapointType _dpt) : 
-			itemId(_itemId), stateGa(_stateGa), writeGa(_writeGa), dpt(_dpt) {}
+			itemId(_itemId), stateGa(_stateGa), writeGa(_writeGa), dpt(_dpt), handle(-1) {}
 	};
 	class Bindings: public std::map<string, Binding> 
 	{
 	public:
-		void add(Binding binding) { insert(value_type(binding.itemId, binding)); }
+		void add(Binding binding) { binding.handle = size(); insert(value_type(binding.itemId, binding)); }
 	};
+	// Control endpoint of a KNX/IP gateway to which a tunnel connection is established.
+	struct Tunnel
+	{
+		IpAddr ipAddr;
+		IpPort ipPort;
+		Tunnel(IpAddr _ipAddr, IpPort _ipPort) : ipAddr(_ipAddr), ipPort(_ipPort) {}
+	};
+	using Tunnels = std::vector<Tunnel>;
 	
 private:
 	IpAddr localIpAddr;
 	bool natMode;
-	IpAddr ipAddr;
-	IpPort ipPort;
+	Tunnels tunnels;
 	Seconds reconnectInterval;
 	Seconds connStateReqInterval;
 	Seconds controlRespTimeout;
 	Seconds tunnelAckTimeout;
 	Seconds ldataConTimeout;
+	Seconds readResponseWindow;
+	int maxBusLoad;
 	PhysicalAddr physicalAddr;
 	bool logRawMsg;
 	bool logData;
 	Bindings bindings;
 
 public:
-	KnxConfig(IpAddr _localIpAddr, bool _natMode, IpAddr _ipAddr, IpPort _ipPort, 
+	KnxConfig(IpAddr _localIpAddr, bool _natMode, Tunnels _tunnels, 
 		Seconds _reconnectInterval, Seconds _connStateReqInterval,
 		Seconds _controlRespTimeout, Seconds _tunnelAckTimeout, Seconds _ldataConTimeout,
-		PhysicalAddr _physicalAddr, bool _logRawMsg, bool _logData, Bindings _bindings) :
-		localIpAddr(_localIpAddr), natMode(_natMode), ipAddr(_ipAddr), ipPort(_ipPort), 
+		Seconds _readResponseWindow, int _maxBusLoad, PhysicalAddr _physicalAddr, bool _logRawMsg, bool _logData, Bindings _bindings) :
+		localIpAddr(_localIpAddr), natMode(_natMode), tunnels(_tunnels), 
 		reconnectInterval(_reconnectInterval), connStateReqInterval(_connStateReqInterval), 
 		controlRespTimeout(_controlRespTimeout), tunnelAckTimeout(_tunnelAckTimeout), ldataConTimeout(_ldataConTimeout),
-		physicalAddr(_physicalAddr), logRawMsg(_logRawMsg), logData(_logData), bindings(_bindings)
+		readResponseWindow(_readResponseWindow), maxBusLoad(_maxBusLoad), physicalAddr(_physicalAddr), logRawMsg(_logRawMsg), logData(_logData), bindings(_bindings)
 	{}
 
 	IpAddr getLocalIpAddr() const { return localIpAddr; }
 	bool getNatMode() const { return natMode; }
-	IpAddr getIpAddr() const { return ipAddr; }
-	IpPort getIpPort() const { return ipPort; }
+	const Tunnels& getTunnels() const { return tunnels; }
 	Seconds getReconnectInterval() const { return reconnectInterval; }
 	Seconds getConnStateReqInterval() const { return connStateReqInterval; }
 	Seconds getControlRespTimeout() const { return controlRespTimeout; }
 	Seconds getTunnelAckTimeout() const { return tunnelAckTimeout; }
 	Seconds getLDataConTimeout() const { return ldataConTimeout; }
+	Seconds getReadResponseWindow() const { return readResponseWindow; }
+	int getMaxBusLoad() const { return maxBusLoad; }
 	PhysicalAddr getPhysicalAddr() const { return physicalAddr; }
 	bool getLogRawMsg() const { return logRawMsg; }
 	bool getLogData() const { return logData; }
@@ -193,62 +171,30 @@ private:
 		WAIT_FOR_CONN_RESP, 
 		CONNECTED,
 	};
-	string id;
-	KnxConfig config;
-	Logger logger;
-	int socket;
-	IpPort localIpPort;
-	IpPort dataIpPort;
-	IpAddr dataIpAddr;
-	State state;
-
-	// Channel id returned in CONNECTION RESPONSE and used for TUNNEL REQUEST.
-	Byte channelId;
-
-	// Physical address returned in CONNECTION RESPONSE or the configured one.
-	PhysicalAddr physicalAddr;
-
-	// Time when last connect attempt has been started.
-	TimePoint lastConnectTry;
 
-	// Has a CONNECTION STATE REQUEST been sent for which a CONNECTION STATE RESPONSE
-	// is pending?
-	bool ongoingConnStateReq;
-
-	// Time when the last CONNECTION REQUEST or CONNECTION STATE REQUST has been sent.
-	TimePoint lastControlReqSendTime;
-
-	// Sequence number of last received and accepted TUNNEL REQUEST.
-	Byte lastReceivedSeqNo;
-
-	// Sequence number of last sent TUNNEL REQUEST.
-	Byte lastSentSeqNo;
+	// L_Data.req messages with high priority (WRITE_REQ and STATE_IND) are sent before the ones
+	// with low priority (READ_REQ).
+	enum Priority
+	{
+		HIGH_PRIORITY,
+		LOW_PRIORITY,
+		PRIORITY_COUNT
+	};
 
 	struct LDataReq
 	{
 		string itemId;
 		GroupAddr ga;
-		ByteString data;
+		Byte data[DatapointType::maxDataLength];
+		int dataLength;
+		Priority priority;
 		int attempts; // already performed successful sends but without matching L_Data.con
-		LDataReq() : attempts(0) {}
-		LDataReq(string _itemId, GroupAddr _ga, ByteString _data) :
-			itemId(_itemId), ga(_ga), data(_data), attempts(0) {}
+		LDataReq() : dataLength(0), priority(LOW_PRIORITY), attempts(0) {}
+		LDataReq(string _itemId, GroupAddr _ga, ByteView _data, Priority _priority) :
+			itemId(_itemId), ga(_ga), dataLength(_data.copy(data, sizeof(data))), priority(_priority), attempts(0) {}
+		ByteView getData() const { return ByteView(data, dataLength); }
 	};
 
-	// L_Data.req messages which are waiting to be sent as TUNNEL REQUEST.
-	std::list<LDataReq> waitingLDataReqs;
-
-	// Last L_Data.req message which has been sent as TUNNEL REQUEST and for which a TUNNEL ACK
-	// is expected.
-	LDataReq lastSentLDataReq;
-
-	// Time when the last TUNNEL REQUEST has been sent. It is set to null when the
-	// TUNNEL ACK is received.
-	TimePoint lastTunnelReqSendTime;
-
-	// Number of times the last TUNNEL REQUEST has already been sent.
-	int lastTunnelReqSendAttempts;
-
 	// L_Data.req messages which have been sent successfully as TUNNEL REQUEST and for which a
 	// TUNNEL ACK has been received but for which no L_Data.con has been received so far.
 	struct SentLDataReq
@@ -257,12 +203,111 @@ private:
 		TimePoint time; // time when TUNNEL REQUEST has been sent
 		SentLDataReq(const LDataReq& _ldataReq, TimePoint _time) : ldataReq(_ldataReq), time(_time) {}
 	};
-	std::list<SentLDataReq> sentLDataReqs;
 
-	// READ_REQ events which have been received and for which so far no STATE_IND has
-	// been received.
-	// Attention: Timeouts are currently not detected.
-	std::set<string> receivedReadReqs;
+	// Tunnel connection to a KNX/IP gateway. Several of them may be used concurrently.
+	struct Tunnel
+	{
+		// Number of the tunnel (starting with 1).
+		int no;
+
+		// Control endpoint of the KNX/IP gateway.
+		IpAddr ipAddr;
+		IpPort ipPort;
+
+		UdpSocket socket;
+		IpPort localIpPort;
+		IpPort dataIpPort;
+		IpAddr dataIpAddr;
+		State state;
+
+		// Channel id returned in CONNECTION RESPONSE and used for TUNNEL REQUEST.
+		Byte channelId;
+
+		// Physical address returned in CONNECTION RESPONSE or the configured one.
+		PhysicalAddr physicalAddr;
+
+		// Time when last connect attempt has been started.
+		TimePoint lastConnectTry;
+
+		// Has a CONNECTION STATE REQUEST been sent for which a CONNECTION STATE RESPONSE
+		// is pending?
+		bool ongoingConnStateReq;
+
+		// Time when the last CONNECTION REQUEST or CONNECTION STATE REQUST has been sent.
+		TimePoint lastControlReqSendTime;
+
+		// Sequence number of last received and accepted TUNNEL REQUEST.
+		Byte lastReceivedSeqNo;
+
+		// Sequence number of last sent TUNNEL REQUEST.
+		Byte lastSentSeqNo;
+
+		// L_Data.req messages which are waiting to be sent as TUNNEL REQUEST (per priority).
+		std::list<LDataReq> waitingLDataReqs[PRIORITY_COUNT];
+
+		// Last L_Data.req message which has been sent as TUNNEL REQUEST and for which a TUNNEL ACK
+		// is expected.
+		LDataReq lastSentLDataReq;
+
+		// Time when the last TUNNEL REQUEST has been sent. It is set to null when the
+		// TUNNEL ACK is received.
+		TimePoint lastTunnelReqSendTime;
+
+		// Number of times the last TUNNEL REQUEST has already been sent.
+		int lastTunnelReqSendAttempts;
+
+		std::list<SentLDataReq> sentLDataReqs;
+
+		Tunnel(int _no, IpAddr _ipAddr, IpPort _ipPort) : 
+			no(_no), ipAddr(_ipAddr), ipPort(_ipPort), state(DISCONNECTED) {}
+	};
+
+	string id;
+	KnxConfig config;
+	Logger logger;
+
+	std::vector<std::unique_ptr<Tunnel>> tunnels;
+
+	// Recently received L_Data.ind messages. Each tunnel delivers its own copy of a telegram on
+	// the bus. Only the first one is processed.
+	struct ReceivedLDataInd
+	{
+		TimePoint time;
+		PhysicalAddr pa;
+		GroupAddr ga;
+		Byte data[DatapointType::maxDataLength];
+		int dataLength;
+		unsigned tunnelMask; // tunnels which have delivered the telegram so far
+		ByteView getData() const { return ByteView(data, dataLength); }
+	};
+	static const int maxReceivedLDataInds = 64;
+	ReceivedLDataInd receivedLDataInds[maxReceivedLDataInds];
+	int nextReceivedLDataInd;
+
+	// Deadlines of READ_REQ events which have been received and for which so far no STATE_IND
+	// has been received (indexed by binding handle, null if none is pending). A STATE_IND is
+	// sent as GroupValueResponse only before the deadline.
+	std::vector<TimePoint> readReqDeadlines;
+
+	// Pending READ_REQ events (binding handles) in the order of their deadlines.
+	std::deque<int> readReqQueue;
+
+	// Number of READ_REQ events which have not been answered in time.
+	int expiredReadReqs;
+
+	// Estimated utilisation (0..1) of the bus behind the gateway(s) at time busLoadTime. It is
+	// derived from the transmission times of all telegrams seen on the bus (L_Data.ind and
+	// L_Data.con) and decays exponentially.
+	double busLoad;
+	TimePoint busLoadTime;
+
+	// Smoothed and minimal round-trip time between TUNNEL ACK and L_Data.con. A smoothed RTT
+	// far above the minimal one indicates that the gateway is queuing telegrams.
+	Clock::duration ldataConRtt;
+	Clock::duration minLDataConRtt;
+
+	// Earliest time for sending the next L_Data.req in order to stay below maxBusLoad.
+	TimePoint nextLDataReqTime;
 
 	// External state of handler.
 	HandlerState handlerState;
@@ -277,35 +322,46 @@ public:
 	virtual Events send(const Items& items, const Events& events) override;
 
 private:
-	void close();
-	void disconnect();
-	Events receiveX(const Items& items);
+	void close(Tunnel& tunnel);
+	void disconnect(Tunnel& tunnel);
+	void updateState();
+	void addReadReq(const KnxConfig::Binding& binding);
+	bool removeReadReq(const KnxConfig::Binding& binding);
+	void processExpiredReadReqs();
+	void addBusLoad(ByteView data);
+	double getBusLoad(TimePoint now);
+	void updateLDataConRtt(Clock::duration rtt);
+	void paceLDataReqs(const LDataReq& ldataReq);
+	void receiveX(Tunnel& tunnel, const Items& items, Events& events);
 	Events sendX(const Items& items, const Events& events);
-	void sendTunnelReq(const LDataReq& ldataReq, Byte seqNo);
-	void sendLDataReq(const LDataReq& ldataReq);
-	void processReceivedLDataCon(ByteString msg);
-	void processReceivedLDataInd(ByteString msg, const Items& items, Events& events);
-	void processReceivedTunnelAck(ByteString msg);
-	void processPendingLDataCons();
-	void processPendingTunnelAck();
-	void processWaitingLDataReqs();
-	bool receiveMsg(ByteString& msg, IpAddr& addr, IpPort& port) const;
-	void sendMsg(IpAddr addr, IpPort port, ByteString msg) const;
-	void sendControlMsg(ByteString msg) const;
-	void sendDataMsg(ByteString msg) const;
-	ByteString createConnReq() const;
-	ByteString createConnStateReq() const;
-	ByteString createDiscReq() const;
-	ByteString createDiscResp() const;
-	ByteString createTunnelReq(Byte seqNo, GroupAddr ga, ByteString data) const;
-	ByteString createTunnelAck(Byte seqNo) const;
-	void checkMsg(ByteString msg) const;
-	void checkTunnelReq(ByteString msg) const;
-	void checkTunnelAck(ByteString msg) const;
-	void checkConnResp(ByteString msg) const;
-	void checkConnStateResp(ByteString msg, Byte channelId) const;
-	void logMsg(ByteString msg, bool received) const;
-	void logTunnelReq(ByteString msg, bool received) const;
+	Tunnel* selectTunnel(GroupAddr ga);
+	void addLDataReq(const LDataReq& ldataReq);
+	bool isDuplicate(const Tunnel& tunnel, PhysicalAddr pa, GroupAddr ga, ByteView data);
+	void sendTunnelReq(Tunnel& tunnel, const LDataReq& ldataReq, Byte seqNo);
+	void sendLDataReq(Tunnel& tunnel, const LDataReq& ldataReq);
+	void processReceivedLDataCon(Tunnel& tunnel, ByteView msg);
+	void processReceivedLDataInd(Tunnel& tunnel, ByteView msg, const Items& items, Events& events);
+	void processReceivedTunnelAck(Tunnel& tunnel, ByteView msg);
+	void processPendingLDataCons(Tunnel& tunnel);
+	void processPendingTunnelAck(Tunnel& tunnel);
+	void processWaitingLDataReqs(Tunnel& tunnel);
+	bool receiveMsg(Tunnel& tunnel, ByteView& msg, IpAddr& addr, IpPort& port);
+	UdpSocket::Msg& newControlMsg(Tunnel& tunnel);
+	UdpSocket::Msg& newDataMsg(Tunnel& tunnel);
+	void flushMsgs(Tunnel& tunnel);
+	void createConnReq(const Tunnel& tunnel, UdpSocket::Msg& msg) const;
+	void createConnStateReq(const Tunnel& tunnel, UdpSocket::Msg& msg) const;
+	void createDiscReq(const Tunnel& tunnel, UdpSocket::Msg& msg) const;
+	void createDiscResp(const Tunnel& tunnel, UdpSocket::Msg& msg) const;
+	void createTunnelReq(const Tunnel& tunnel, UdpSocket::Msg& msg, Byte seqNo, GroupAddr ga, ByteView data) const;
+	void createTunnelAck(const Tunnel& tunnel, UdpSocket::Msg& msg, Byte seqNo) const;
+	void checkMsg(ByteView msg) const;
+	void checkTunnelReq(ByteView msg, Byte channelId) const;
+	void checkTunnelAck(ByteView msg) const;
+	void checkConnResp(ByteView msg) const;
+	void checkConnStateResp(ByteView msg, Byte channelId) const;
+	void logMsg(ByteView msg, bool received) const;
+	void logTunnelReq(ByteView msg, bool received) const;
 	string getStatusCodeName(Byte statusCode) const;
 	string getStatusCodeExplanation(Byte statusCode) const;
 	string getStatusCodeText(Byte statusCode) const;
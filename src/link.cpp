@@ -69,7 +69,7 @@ Value Modifier::convertInbound(const Value& value) const
 }
 
 Link::Link(LinkId id, bool enabled, bool suppressReadEvents,
-	ItemId operationalItemId, ItemId errorCounterItemId,
+	ItemId operationalItemId, ItemId errorCounterItemId, std::map<string, ItemId> metricItemIds,
 	int maxReceiveDuration, int maxSendDuration,
 	bool numberAsString, bool booleanAsString,
 	string falseValue, string trueValue,
@@ -80,7 +80,7 @@ Link::Link(LinkId id, bool enabled, bool suppressReadEvents,
 	bool suppressUndefined,
 	Modifiers modifiers, std::shared_ptr<HandlerIf> handler, Logger logger) :
 	id(id), enabled(enabled), suppressReadEvents(suppressReadEvents),
-	operationalItemId(operationalItemId), errorCounterItemId(errorCounterItemId),
+	operationalItemId(operationalItemId), errorCounterItemId(errorCounterItemId), metricItemIds(metricItemIds),
 	maxReceiveDuration(maxReceiveDuration), maxSendDuration(maxSendDuration),
 	numberAsString(numberAsString), booleanAsString(booleanAsString),
 	falseValue(falseValue), trueValue(trueValue),
@@ -117,6 +117,15 @@ void Link::validate(Items& items) const
 		item.setReadable(false);
 		item.setWritable(false);
 	}
+	for (auto& [metric, itemId] : metricItemIds)
+	{
+		Item& item = items.validate(itemId);
+		item.validateOwnerId(controlLinkId);
+		item.validateValueType(ValueType::NUMBER);
+		item.validatePollingEnabled(false);
+		item.setReadable(false);
+		item.setWritable(false);
+	}
 
 	for (auto& [itemId, modifier] : modifiers)
 	{
@@ -150,15 +159,29 @@ Events Link::receive(Items& items)
 		if (runtime > maxReceiveDuration)
 			logger.warn() << "Event receiving took " << runtime << " ms" << endOfMsg();
 
-		// monitor handler state
-		HandlerState state = handler->getState();
-		if (operationalItemId != "" && state.operational != oldHandlerState.operational)
-			events.add(Event(controlLinkId, operationalItemId, EventType::STATE_IND, Value::newBoolean(state.operational)));
-		if (errorCounterItemId != "" &&  state.errorCounter != oldHandlerState.errorCounter)
-			events.add(Event(controlLinkId, errorCounterItemId, EventType::STATE_IND, Value::newNumber(state.errorCounter)));
-		oldHandlerState = state;
+		monitorHandlerState(events);
+
+		// take over item values of a snapshot
+		if (Events snapshot = handler->takeSnapshot(); snapshot.size())
+		{
+			convertInbound(items, snapshot);
+			int count = 0;
+			for (auto& event : snapshot)
+				if (Item& item = items.get(event.getItemId()); event.getType() == EventType::STATE_IND && item.getLastValue().isNull())
+				{
+					item.setLastValue(event.getValue());
+					count++;
+				}
+			logger.info() << "Values of " << count << " items taken over from snapshot" << endOfMsg();
+		}
 	}
 
+	convertInbound(items, events);
+	return events;
+}
+
+void Link::convertInbound(Items& items, Events& events)
+{
 	for (auto eventPos = events.begin(); eventPos != events.end();)
 	{
 		// provide event
@@ -482,8 +505,6 @@ Events Link::receive(Items& items)
 
 		eventPos++;
 	}
-
-	return events;
 }
 
 void Link::send(Items& items, const Events& events)
@@ -610,12 +631,20 @@ void Link::send(Items& items, const Events& events)
 	if (runtime > maxReceiveDuration)
 		logger.warn() << "Event sending took " << runtime << " ms" << endOfMsg();
 
-	// monitor handler state
+	monitorHandlerState(pendingEvents);
+}
+
+void Link::monitorHandlerState(Events& events)
+{
 	HandlerState state = handler->getState();
 	if (operationalItemId != "" && state.operational != oldHandlerState.operational)
-		pendingEvents.add(Event(controlLinkId, operationalItemId, EventType::STATE_IND, Value::newBoolean(state.operational)));
+		events.add(Event(controlLinkId, operationalItemId, EventType::STATE_IND, Value::newBoolean(state.operational)));
 	if (errorCounterItemId != "" &&  state.errorCounter != oldHandlerState.errorCounter)
-		pendingEvents.add(Event(controlLinkId, errorCounterItemId, EventType::STATE_IND, Value::newNumber(state.errorCounter)));
+		events.add(Event(controlLinkId, errorCounterItemId, EventType::STATE_IND, Value::newNumber(state.errorCounter)));
+	for (auto& [metric, itemId] : metricItemIds)
+		if (auto pos = state.metrics.find(metric); pos != state.metrics.end())
+			if (auto oldPos = oldHandlerState.metrics.find(metric); oldPos == oldHandlerState.metrics.end() || oldPos->second != pos->second)
+				events.add(Event(controlLinkId, itemId, EventType::STATE_IND, Value::newNumber(pos->second)));
 	oldHandlerState = state;
 }
 
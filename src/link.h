@@ -72,6 +72,9 @@ struct HandlerState
 {
 	int errorCounter = 0;
 	bool operational = false;
+
+	// Handler specific figures (e.g. queue lengths) which can be reported on items.
+	std::map<string, Number> metrics;
 };
 
 // Interface for exchanging events with an external system.
@@ -96,6 +99,10 @@ public:
 
 	// Events returned by receive() are passed to all handlers via this method.
 	virtual Events send(const Items& items, const Events& events) = 0;
+
+	// Returns STATE_IND events which have been collected as a whole (e.g. at startup) and whose
+	// values are taken over as last item values without being distributed to other handlers.
+	virtual Events takeSnapshot() { return Events(); }
 };
 
 class Link
@@ -116,6 +123,9 @@ private:
 	// Id of item on which the number of occurred errors on the link will be reported.
 	ItemId errorCounterItemId;
 
+	// Ids of items on which the handler metrics will be reported (metric name -> item id).
+	std::map<string, ItemId> metricItemIds;
+
 	// A warning message is generated in case event receiving over the link requires
 	// more time than defined here in milliseconds.
 	int maxReceiveDuration;
@@ -193,7 +203,7 @@ private:
 
 public:
 	Link(LinkId id, bool enabled, bool suppressReadEvents,
-		ItemId operationalItemId, ItemId errorCounterItemId,
+		ItemId operationalItemId, ItemId errorCounterItemId, std::map<string, ItemId> metricItemIds,
 		int maxReceiveDuration, int maxSendDuration,
 		bool numberAsString, bool booleanAsString,
 		string falseValue, string trueValue,
@@ -209,6 +219,14 @@ public:
 	long collectFds(fd_set* readFds, fd_set* writeFds, fd_set* excpFds, int* maxFd);
 	void send(Items& items, const Events& events);
 	Events receive(Items& items);
+
+private:
+	// Generates STATE_IND events for changes of the handler state.
+	void monitorHandlerState(Events& events);
+
+	// Checks and converts events received from the handler. Events which can not be processed
+	// are removed.
+	void convertInbound(Items& items, Events& events);
 };
 
 class Links: public std::map<LinkId, Link>
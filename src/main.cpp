@@ -159,6 +159,7 @@ int main(int argc, char* argv[])
 
 					if (linkTimeoutMs != -1)
 						timeoutMs = std::min(timeoutMs, linkTimeoutMs);
+					maxFd = std::max(maxFd, linkMaxFd);
 					for (int fd = 0; fd <= linkMaxFd; fd++)
 					{
 						if (FD_ISSET(fd, &linkReadFds))
@@ -195,7 +196,7 @@ int main(int argc, char* argv[])
 						logMsg << fd;
 						if (FD_ISSET(fd, &readFds))
 							logMsg << "r";
-						if (FD_ISSET(fd, &readFds))
+						if (FD_ISSET(fd, &writeFds))
 							logMsg << "w";
 						if (FD_ISSET(fd, &excpFds))
 							logMsg << "e";
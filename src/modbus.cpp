@@ -1,9 +1,13 @@
 #include <cmath>
+#include <algorithm>
+#include <array>
 
 #include <unistd.h>
 #include <errno.h> 
 #include <netdb.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
 
 #include "finally.h"
 #include "modbus.h"
@@ -11,16 +15,54 @@
 namespace modbus
 {
 
+// CRC-16 (polynomial 0xA001, reflected) protecting Modbus RTU frames.
+static uint16_t crc16(ByteView data)
+{
+	static const auto table = []
+	{
+		std::array<uint16_t, 256> table;
+		for (int i = 0; i < 256; i++)
+		{
+			uint16_t crc = i;
+			for (int bit = 0; bit < 8; bit++)
+				crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+			table[i] = crc;
+		}
+		return table;
+	}();
+
+	uint16_t crc = 0xFFFF;
+	for (Byte b : data)
+		crc = (crc >> 8) ^ table[(crc ^ b) & 0xFF];
+	return crc;
+}
+
+// Minimum silence between two Modbus RTU frames (3.5 character times, fixed above 19200 baud).
+static std::chrono::microseconds getFrameSilence(int baudRate)
+{
+	if (baudRate > 19200)
+		return std::chrono::microseconds(1750);
+	return std::chrono::microseconds(3500000 * 11 / baudRate);
+}
+
 Handler::Handler(string id, Config config, Logger logger) :
 	id(id), config(config), logger(logger)
 {
 	handlerState.errorCounter = 0;
 	handlerState.operational = false;
+
+	if (config.isRtu())
+		devices.emplace_back(new Device("", config.getSerialPort().name, "", 0, 1, config.getConnectTimeout()));
+	else
+		for (auto& device : config.getDevices())
+			devices.emplace_back(new Device(device.name, device.hostname + ":" + cnvToStr(device.port),
+				device.hostname, device.port, device.maxInFlight, config.getConnectTimeout()));
 }
 
 Handler::~Handler()
 { 
-	close(); 
+	for (auto& device : devices)
+		close(*device);
 }
 
 void Handler::validate(Items& items)
@@ -37,119 +79,225 @@ void Handler::validate(Items& items)
 		item.validateOwnerId(id);
 		item.setReadable(true);
 		item.setWritable(false);
+
+		if (binding.registerCount() > MAX_READ_REGISTERS)
+			throw std::runtime_error("Register range of binding for item " + itemId + " exceeds " + cnvToStr(MAX_READ_REGISTERS) + " registers");
+
+		Device* device = findDevice(binding.device);
+		if (!device)
+			throw std::runtime_error("Binding for item " + itemId + " refers to unknown device " + binding.device);
+		device->unitBindings[binding.unitId].push_back(&binding);
 	}
+
+	for (auto& device : devices)
+		for (auto& [unitId, bindings] : device->unitBindings)
+			std::sort(bindings.begin(), bindings.end(),
+				[](auto x, auto y) { return x->firstRegister() < y->firstRegister(); });
 }
 
-bool Handler::open()
+Handler::Device* Handler::findDevice(const string& name) const
+{
+	for (auto& device : devices)
+		if (device->name == name)
+			return device.get();
+	return nullptr;
+}
+
+bool Handler::open(Device& device)
 {
 	// connection already established?
-	if (socket >= 0)
+	if (device.fd >= 0)
 		return true;
 
-	// shell we perform another attempt to connect to the remote site?
+	if (config.isRtu())
+		return openSerialPort(device);
+
+	if (!device.connector.isActive())
+	{
+		// shell we perform another attempt to connect to the remote site?
+		TimePoint now = Clock::now();
+		if (device.lastConnectTry + config.getReconnectInterval() > now)
+			return false;
+		device.lastConnectTry = now;
+		device.lastDataReceipt = now;
+
+		device.connector.start();
+	}
+
+	// connection attempt still in progress?
+	device.fd = device.connector.process();
+	if (device.fd < 0)
+		return false;
+	device.lastDataReceipt = Clock::now();
+
+	logger.info() << "Connected to " << device.displayName << endOfMsg();
+	updateState();
+
+	return true;
+}
+
+bool Handler::openSerialPort(Device& device)
+{
+	// shell we perform another attempt to open the port?
 	TimePoint now = Clock::now();
-	if (lastConnectTry + config.getReconnectInterval() > now)
+	if (device.lastConnectTry + config.getReconnectInterval() > now)
 		return false;
-	lastConnectTry = now;
-	lastDataReceipt = now;
-
-	addrinfo hints;
-	addrinfo* addrs;
-//	hints.ai_family = AF_UNSPEC;
-	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = IPPROTO_TCP;
-	hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
-	int rc = getaddrinfo(config.getHostname().c_str(), cnvToStr(config.getPort()).c_str(), &hints, &addrs);
-	if (rc != 0)
-		logger.errorX() << "Error " << rc << " (" << gai_strerror(rc) << ") occurred in function getaddrinfo" << endOfMsg();
-	auto autoFree = finally([addrs] { freeaddrinfo(addrs); });
-
-	socket = ::socket(AF_INET, SOCK_STREAM /*| SOCK_NONBLOCK*/, 0);
-	if (socket == -1)
-		logger.errorX() << unixError("socket") << endOfMsg();
-	auto autoClose = finally([this] { ::close(socket); socket = -1; });
-
-	if (connect(socket, addrs->ai_addr, addrs->ai_addrlen) == -1)
-		logger.errorX() << unixError("connect") << endOfMsg();
-
-	int flags = fcntl(socket, F_GETFL);
-	if (flags == -1)
-		logger.errorX() << unixError("fcntl") << endOfMsg();
-	if (fcntl(socket, F_SETFL, flags | O_NONBLOCK) == -1)
-		logger.errorX() << unixError("fcntl") << endOfMsg();
+	device.lastConnectTry = now;
+	device.lastDataReceipt = now;
+
+	auto& serialPort = config.getSerialPort();
+	int fd = ::open(serialPort.name.c_str(), O_RDWR | O_NONBLOCK | O_NOCTTY);
+	if (fd < 0)
+		logger.errorX() << unixError("open") << endOfMsg();
+	auto autoClose = finally([fd] { ::close(fd); });
+
+	setupSerialPort(fd, serialPort.baudRate, serialPort.dataBits, serialPort.stopBits, serialPort.parity, device.oldSettings);
+
+	// discard stale data
+	tcflush(fd, TCIOFLUSH);
 
 	autoClose.disable();
+	device.fd = fd;
+	device.busFreeTime = now;
 
-	logger.info() << "Connected to " << config.getHostname() << ":" << config.getPort() << endOfMsg();
-	handlerState.operational = true;
+	logger.info() << "Serial port " << serialPort.name << " open" << endOfMsg();
+	updateState();
 
 	return true;
 }
 
-void Handler::close()
+void Handler::close(Device& device)
 {
-	if (socket < 0)
+	device.connector.reset();
+
+	if (device.fd < 0)
 		return;
 
-	::close(socket);
-	socket = -1;
-	lastConnectTry.setToNull();
-	lastDataReceipt.setToNull();
-	requests.clear();
-	streamData.clear();
+	if (config.isRtu())
+		tcsetattr(device.fd, TCSANOW, &device.oldSettings);
+	::close(device.fd);
+	device.fd = -1;
+	device.lastConnectTry.setToNull();
+	device.lastDataReceipt.setToNull();
+	requestCount -= device.requests.size();
+	device.requests.clear();
+	device.deadlines = decltype(device.deadlines)();
+	device.waitingRanges.clear();
+	device.waitingCount = 0;
+	device.streamData.clear();
+	device.outputData.clear();
+	device.unitReadyTimes.clear();
+
+	if (config.isRtu())
+		logger.info() << "Serial port " << device.displayName << " closed" << endOfMsg();
+	else
+		logger.info() << "Disconnected from " << device.displayName << endOfMsg();
+	updateState();
+}
 
-	logger.info() << "Disconnected from " << config.getHostname() << ":" << config.getPort() << endOfMsg();
+void Handler::updateState()
+{
 	handlerState.operational = false;
+	for (auto& device : devices)
+		if (device->fd >= 0)
+			handlerState.operational = true;
 }
 
 long Handler::collectFds(fd_set* readFds, fd_set* writeFds, fd_set* excpFds, int* maxFd)
 {
-	if (socket != -1)
+	long timeoutMs = -1;
+	auto addTimeout = [&timeoutMs](long ms)
+	{
+		if (ms != -1 && (timeoutMs == -1 || ms < timeoutMs))
+			timeoutMs = ms;
+	};
+
+	for (auto& device : devices)
 	{
-		FD_SET(socket, readFds);
-		*maxFd = std::max(*maxFd, socket);
+		if (device->connector.isActive())
+		{
+			addTimeout(device->connector.collectFds(writeFds, maxFd));
+			continue;
+		}
+
+		if (device->fd != -1)
+		{
+			FD_SET(device->fd, readFds);
+			if (!device->outputData.empty())
+				FD_SET(device->fd, writeFds);
+			*maxFd = std::max(*maxFd, device->fd);
+		}
+
+		// wake up for the next response deadline or the next request on the serial bus
+		TimePoint wakeUpTime;
+		if (!device->deadlines.empty())
+			wakeUpTime = device->deadlines.top().first;
+		if (TimePoint sendTime = getRtuSendTime(*device); !sendTime.isNull() && (wakeUpTime.isNull() || sendTime < wakeUpTime))
+			wakeUpTime = sendTime;
+		if (!wakeUpTime.isNull())
+			addTimeout(std::max(0L, long(std::chrono::duration_cast<std::chrono::milliseconds>(wakeUpTime - Clock::now()).count())));
 	}
 
-	return -1;
+	return timeoutMs;
 }
 
 Events Handler::receive(const Items& items)
 {
-	try
-	{
-		return receiveX(items);
-	}
-	catch (const std::exception& ex)
+	Events events;
+
+	for (auto& device : devices)
 	{
-		handlerState.errorCounter++;
+		try
+		{
+			receiveX(*device, items, events);
+			continue;
+		}
+		catch (const std::exception& ex)
+		{
+			handlerState.errorCounter++;
 
-		logger.error() << ex.what() << endOfMsg();
+			logger.error() << ex.what() << endOfMsg();
+		}
+
+		close(*device);
 	}
 
-	close();
-	return Events();
+	// answered and expired requests free slots for waiting ones
+	sendRequests();
+
+	return events;
 }
 
-Events Handler::receiveX(const Items& items)
+void Handler::receiveX(Device& device, const Items& items, Events& events)
 {
-	Events events;
-
 	// try to connect to remote site
-	if (!open())
-		return events;
+	if (!open(device))
+		return;
 
 	// read all available data
-	receiveData();
+	receiveData(device);
 
 	// analyze available data
-	while (streamData.length() >= 6)
+	if (config.isRtu())
+		processRtuResponses(device, items, events);
+	else
+		processTcpResponses(device, items, events);
+
+	// check for response timeouts
+	processExpiredRequests(device);
+}
+
+void Handler::processTcpResponses(Device& device, const Items& items, Events& events)
+{
+	auto& streamData = device.streamData;
+	ByteView data = streamData.byteView();
+	while (data.length() >= 6)
 	{
-		int length = streamData[4] << 8 | streamData[5];
-		if (streamData.length() >= length + 6)
+		std::size_t length = data[4] << 8 | data[5];
+		if (data.length() >= length + 6)
 		{
 			// complete response available
-			ByteString msg = streamData.substr(0, length + 6);
+			ByteView msg = data.substr(0, length + 6);
 
 			// verify response consistency
 			if (msg.length() < 9)
@@ -158,199 +306,557 @@ Events Handler::receiveX(const Items& items)
 				logger.errorX() << "Invalid response " + cnvToHexStr(msg) + " received (2)" << endOfMsg();
 
 			// extract fields from response
-			Byte receivedTransactionId = msg[1];
-			ByteString data = msg.substr(9);
+			TransactionId receivedTransactionId = msg[0] << 8 | msg[1];
+			ByteView registerData = msg.substr(9);
 
 			// trace response
 			if (config.getLogMsgs())
-				logger.debug() << "Response " <<  static_cast<int>(receivedTransactionId) << "," << static_cast<int>(msg[6]) << "," << cnvToHexStr(data) << endOfMsg();
+				logger.debug() << "Response " <<  static_cast<int>(receivedTransactionId) << "," << static_cast<int>(msg[6]) << "," << cnvToHexStr(registerData) << endOfMsg();
 
 			// process response
-			if (auto requestPos = requests.find(receivedTransactionId); requestPos != requests.end())
+			if (auto requestPos = device.requests.find(receivedTransactionId); requestPos != device.requests.end())
 			{
-				// matching request with binding found
-				auto& [itemId, binding] = *requestPos->second.second;
-
-				// verify response against binding definition
-				if (data.length() != (binding.lastRegister() - binding.firstRegister() + 1) * 2)
-					logger.errorX() << "Response " + cnvToHexStr(msg) + " does not match binding definition of item " + itemId << endOfMsg();
-
-				auto convert = [](ByteString data)
-				{
-					assert(data.length() <= sizeof(uint64_t));
-					uint64_t value = 0;
-					if (data[0] & 0x80)
-					{
-						for (int i = 0; i < data.length(); i++)
-							value = (value << 8) | (~data[i] & 0xFF);
-						return -1.0 * value - 1;
-					}
-					else
-					{
-						for (int i = 0; i < data.length(); i++)
-							value = (value << 8) | data[i];
-						return 1.0 * value;
-					}
-				};
-
-				auto addEvent = [&](ByteString data, int baseRegister, ItemId itemId, const Config::Binding& binding)
-				{
-					ByteString registerData = data.substr((binding.valueRegister - baseRegister) * 2, binding.valueRegisterCount * 2);
-					if (items.get(itemId).hasValueType(ValueType::NUMBER))
-					{
-						Number num = convert(registerData);
-						if (binding.factorRegister >= 0)
-							num *= std::pow(10, convert(data.substr((binding.factorRegister - baseRegister) * 2, 2)));
-						events.add(Event(id, itemId, EventType::STATE_IND, Value::newNumber(num)));
-					}
-					else
-						events.add(Event(id, itemId, EventType::STATE_IND, Value::newString(cnvToHexStr(registerData))));
-				};
-
-				// generate event for binding
-				addEvent(data, binding.firstRegister(), itemId, binding);
-
-				// generate events for other bindings if possible
-				for (auto& [otherItemId, otherBinding] : config.getBindings())
-					if (itemId != otherItemId && binding.unitId == otherBinding.unitId)
-					{
-						// verify that register range of other binding is covered
-						if (otherBinding.firstRegister() < binding.firstRegister() || otherBinding.lastRegister() > binding.lastRegister())
-							continue;
-
-						// generate event for other binding
-						addEvent(data, binding.firstRegister(), otherItemId, otherBinding);
-					}
-
-				// discard request information
-				requests.erase(requestPos);
+				RegisterRange range = requestPos->second.range;
+				finishRequest(device, requestPos);
+				processResponse(device, items, range, msg, registerData, events);
 			}
 			else
-				logger.errorX() << "No matching pending request for received response " + cnvToHexStr(msg) << endOfMsg();
+				// late response to an expired request, the other requests in flight are not affected
+				logger.warn() << "No matching pending request for received response " + cnvToHexStr(msg) << endOfMsg();
 
 			// discard processed response
-			streamData.erase(0, msg.length());
+			streamData.consume(msg.length());
+			data.remove_prefix(msg.length());
 		}
 		else
 			break;
 	}
+}
 
-	// check for response timeouts
-	for (auto requestPos = requests.begin(); requestPos != requests.end();)
+void Handler::processRtuResponses(Device& device, const Items& items, Events& events)
+{
+	auto& streamData = device.streamData;
+	while (!streamData.empty())
 	{
-		auto& request = requestPos->second;
-		if (Clock::now() > request.first + config.getResponseTimeout())
+		// only one request is pending on the bus, without it the data can not be interpreted
+		if (device.requests.empty())
 		{
-			logger.warn() << "No response within expected time span for " + request.second->first + " query request" << endOfMsg();
-			requestPos = requests.erase(requestPos);
+			logger.warn() << "Unexpected data " << cnvToHexStr(streamData.byteView()) << " received" << endOfMsg();
+			streamData.clear();
+			return;
 		}
-		else
-			requestPos++;
+		auto requestPos = device.requests.begin();
+		RegisterRange range = requestPos->second.range;
+
+		// complete response available?
+		ByteView data = streamData.byteView();
+		if (data.length() < 5)
+			return;
+		std::size_t length = data[1] & 0x80 ? 5 : 5 + range.registerCount * 2;
+		if (data.length() < length)
+			return;
+		ByteView msg = data.substr(0, length);
+		streamData.consume(length);
+
+		// request is finished with any response
+		finishRequest(device, requestPos);
+
+		// verify response consistency
+		if (crc16(msg.substr(0, length - 2)) != (msg[length - 2] | msg[length - 1] << 8))
+		{
+			logger.warn() << "Response " << cnvToHexStr(msg) << " with invalid checksum received" << endOfMsg();
+			streamData.clear();
+			continue;
+		}
+		if (msg[0] != range.unitId || (msg[1] & 0x7F) != 0x03)
+		{
+			logger.warn() << "Response " << cnvToHexStr(msg) << " does not belong to pending request" << endOfMsg();
+			streamData.clear();
+			continue;
+		}
+		if (msg[1] & 0x80)
+		{
+			logger.warn() << "Exception " << static_cast<int>(msg[2]) << " returned by unit " << static_cast<int>(range.unitId)
+			              << " for registers " << range.firstRegister << "-" << range.lastRegister() << endOfMsg();
+			continue;
+		}
+
+		// trace response
+		ByteView registerData = msg.substr(3, length - 5);
+		if (config.getLogMsgs())
+			logger.debug() << "Response " << static_cast<int>(msg[0]) << "," << cnvToHexStr(registerData) << endOfMsg();
+
+		processResponse(device, items, range, msg, registerData, events);
 	}
+}
 
-	return events;
+void Handler::processResponse(Device& device, const Items& items, const RegisterRange& range, ByteView msg, ByteView data, Events& events)
+{
+	// verify response against request
+	if (data.length() != range.registerCount * 2)
+		logger.errorX() << "Response " + cnvToHexStr(msg) + " does not match requested register range" << endOfMsg();
+
+	// generate events for all bindings whose registers are up to date now
+	TimePoint now = Clock::now();
+	cacheRegisters(device, range, data, now);
+	addEvents(device, items, range, now - config.getMaxCacheAge(), events);
 }
 
-void Handler::receiveData()
+void Handler::finishRequest(Device& device, std::unordered_map<TransactionId, Request>::iterator requestPos)
 {
-	// receive data
-	Byte buffer[256];
-	int rc = ::read(socket, buffer, sizeof(buffer));
-	if (rc < 0)
-		if (errno == EWOULDBLOCK || errno == EAGAIN)
-			return;
-		else
-			logger.errorX() << unixError("read") << endOfMsg();
-	if (rc == 0)
-		logger.errorX() << "Disconnect by remote party" << endOfMsg();
-	ByteString receivedData(buffer, rc);
+	Byte unitId = requestPos->second.range.unitId;
+	device.requests.erase(requestPos);
+	requestCount--;
 
-	if (receivedData.length())
+	// on the serial bus the next frame must wait for the silence and the unit needs time to turn around
+	if (config.isRtu())
 	{
-		// trace received data
-		if (config.getLogRawData())
-			logger.debug() << "R " << cnvToHexStr(receivedData) << endOfMsg();
+		TimePoint now = Clock::now();
+		device.busFreeTime = now + getFrameSilence(config.getSerialPort().baudRate);
+		device.unitReadyTimes[unitId] = now + config.getTurnaroundDelay(unitId);
+	}
+}
 
-		// append received data to overall data
-		streamData += receivedData;
+void Handler::processExpiredRequests(Device& device)
+{
+	TimePoint now = Clock::now();
+	while (!device.deadlines.empty() && device.deadlines.top().first < now)
+	{
+		auto [deadline, transactionId] = device.deadlines.top();
+		device.deadlines.pop();
+
+		// request still pending and not replaced by a later one with the same transaction id?
+		auto requestPos = device.requests.find(transactionId);
+		if (requestPos == device.requests.end() || requestPos->second.deadline != deadline)
+			continue;
+
+		auto& range = requestPos->second.range;
+		logger.warn() << "No response within expected time span for query request of unit " << static_cast<int>(range.unitId)
+		              << " and registers " << range.firstRegister << "-" << range.lastRegister() << " on " << device.displayName << endOfMsg();
+		finishRequest(device, requestPos);
+
+		// a partially received response is useless now
+		if (config.isRtu())
+			device.streamData.clear();
+	}
+}
 
-		// remember time of data receipt
-		lastDataReceipt = Clock::now();
+void Handler::cacheRegisters(Device& device, const RegisterRange& range, ByteView data, TimePoint time)
+{
+	auto& registers = device.registerCache[range.unitId];
+	for (int i = 0; i < range.registerCount; i++)
+		registers[range.firstRegister + i] = {uint16_t(data[2 * i] << 8 | data[2 * i + 1]), time};
+}
+
+void Handler::addEvents(const Device& device, const Items& items, const RegisterRange& range, TimePoint minTime, Events& events) const
+{
+	auto bindingsPos = device.unitBindings.find(range.unitId);
+	if (bindingsPos == device.unitBindings.end())
+		return;
+
+	for (auto binding : bindingsPos->second)
+	{
+		// bindings are ordered by their first register
+		if (binding->firstRegister() > range.lastRegister())
+			break;
+
+		// bindings partially outside of the range need the other registers from the cache
+		if (range.overlaps(*binding) && getStaleRanges(device, *binding, minTime).empty())
+			addEvent(device, items, *binding, events);
 	}
 }
 
-Events Handler::send(const Items& items, const Events& events)
+void Handler::addEvent(const Device& device, const Items& items, const Config::Binding& binding, Events& events) const
 {
-	try
+	auto convert = [](ByteString data)
 	{
-		sendX(items, events);
-		return Events();
+		assert(data.length() <= sizeof(uint64_t));
+		uint64_t value = 0;
+		if (data[0] & 0x80)
+		{
+			for (int i = 0; i < data.length(); i++)
+				value = (value << 8) | (~data[i] & 0xFF);
+			return -1.0 * value - 1;
+		}
+		else
+		{
+			for (int i = 0; i < data.length(); i++)
+				value = (value << 8) | data[i];
+			return 1.0 * value;
+		}
+	};
+
+	// collect register data of binding from cache
+	auto& registers = device.registerCache.at(binding.unitId);
+	auto getData = [&](int firstRegister, int registerCount)
+	{
+		ByteString data;
+		for (int r = firstRegister; r < firstRegister + registerCount; r++)
+		{
+			uint16_t value = registers.at(r).value;
+			data += ByteString({Byte(value >> 8), Byte(value & 0xFF)});
+		}
+		return data;
+	};
+
+	ByteString registerData = getData(binding.valueRegister, binding.valueRegisterCount);
+	if (items.get(binding.itemId).hasValueType(ValueType::NUMBER))
+	{
+		Number num = convert(registerData);
+		if (binding.factorRegister >= 0)
+			num *= std::pow(10, convert(getData(binding.factorRegister, 1)));
+		events.add(Event(id, binding.itemId, EventType::STATE_IND, Value::newNumber(num)));
 	}
-	catch (const std::exception& ex)
+	else
+		events.add(Event(id, binding.itemId, EventType::STATE_IND, Value::newString(cnvToHexStr(registerData))));
+}
+
+RegisterRanges Handler::getStaleRanges(const Device& device, const Config::Binding& binding, TimePoint minTime) const
+{
+	RegisterRanges ranges;
+	auto registersPos = device.registerCache.find(binding.unitId);
+	for (int r = binding.firstRegister(); r <= binding.lastRegister(); r++)
 	{
-		handlerState.errorCounter++;
+		if (registersPos != device.registerCache.end())
+			if (auto pos = registersPos->second.find(r); pos != registersPos->second.end() && pos->second.time >= minTime)
+				continue;
 
-		logger.error() << ex.what() << endOfMsg();
+		// extend the previous stale range or start a new one
+		if (!ranges.empty() && ranges.back().lastRegister() == r - 1)
+			ranges.back().registerCount++;
+		else
+			ranges.emplace_back(binding.unitId, r, 1);
 	}
+	return ranges;
+}
+
+void Handler::receiveData(Device& device)
+{
+	// receive all available data, bounded to keep other devices responsive
+	bool eof;
+	std::size_t receivedBytes = device.streamData.readFrom(device.fd, eof);
+	if (eof && !receivedBytes)
+		logger.errorX() << "Disconnect by remote party " << device.displayName << endOfMsg();
+
+	if (receivedBytes)
+	{
+		// trace received data
+		if (config.getLogRawData())
+		{
+			ByteView data = device.streamData.byteView();
+			logger.debug() << "R " << cnvToHexStr(data.substr(data.length() - receivedBytes)) << endOfMsg();
+		}
 
-	close();
-	return Events();
+		// remember time of data receipt
+		device.lastDataReceipt = Clock::now();
+	}
 }
 
-void Handler::sendX(const Items& items, const Events& events)
+Events Handler::send(const Items& items, const Events& events)
 {
-	// try to connect to remote site
-	if (!open())
-		return;
+	Events cachedEvents;
 
+	// answer read requests from the cache, collect the registers still to be read per device
+	TimePoint minTime = Clock::now() - config.getMaxCacheAge();
+	std::map<Device*, RegisterRanges> readRanges;
 	auto& bindings = config.getBindings();
 	for (auto& event : events)
-		if (auto bindingPos = bindings.find(event.getItemId()); bindingPos != bindings.end())
+		if (event.getType() == EventType::READ_REQ)
+			if (auto bindingPos = bindings.find(event.getItemId()); bindingPos != bindings.end())
+			{
+				auto& binding = bindingPos->second;
+				Device* device = findDevice(binding.device);
+
+				RegisterRanges staleRanges;
+				if (config.getMaxCacheAge() > 0s)
+					staleRanges = getStaleRanges(*device, binding, minTime);
+				else
+					staleRanges.emplace_back(binding.unitId, binding.firstRegister(), binding.registerCount());
+
+				if (staleRanges.empty())
+					addEvent(*device, items, binding, cachedEvents);
+				else if (device->fd >= 0)
+					for (auto& range : staleRanges)
+						if (!isPending(*device, range))
+							readRanges[device].push_back(range);
+			}
+
+	// read them with as few requests as possible
+	for (auto& [device, ranges] : readRanges)
+		for (auto& range : planReads(ranges))
 		{
-			auto& binding = bindingPos->second;
+			device->waitingRanges[range.unitId].push_back(range);
+			device->waitingCount++;
+		}
+	sendRequests();
 
-			if (event.getType() == EventType::READ_REQ)
+	return cachedEvents;
+}
+
+bool Handler::isPending(const Device& device, const RegisterRange& range) const
+{
+	// the response to a waiting or sent request will deliver the registers anyway, so polling a slow
+	// device faster than it answers does not let the queue grow
+	if (auto pos = device.waitingRanges.find(range.unitId); pos != device.waitingRanges.end())
+		for (auto& waitingRange : pos->second)
+			if (waitingRange.covers(range))
+				return true;
+	for (auto& [transactionId, request] : device.requests)
+		if (request.range.covers(range))
+			return true;
+	return false;
+}
+
+RegisterRanges Handler::planReads(RegisterRanges readRanges) const
+{
+	std::sort(readRanges.begin(), readRanges.end(), [](auto& x, auto& y)
+	{
+		return x.unitId < y.unitId || (x.unitId == y.unitId && x.firstRegister < y.firstRegister);
+	});
+
+	// merge neighbouring register ranges as long as the gap between them is tolerable and the 
+	// merged range can still be read with one request
+	RegisterRanges ranges;
+	for (auto& readRange : readRanges)
+	{
+		if (!ranges.empty())
+		{
+			auto& range = ranges.back();
+			int lastRegister = std::max(range.lastRegister(), readRange.lastRegister());
+			if (  range.unitId == readRange.unitId
+			   && readRange.firstRegister <= range.lastRegister() + 1 + config.getMaxRegisterGap()
+			   && lastRegister - range.firstRegister + 1 <= MAX_READ_REGISTERS
+			   )
 			{
-				lastTransactionId++;
-
-				// trace request
-				if (config.getLogMsgs())
-					logger.debug() << "Request " <<  static_cast<int>(lastTransactionId) << "," << static_cast<int>(binding.unitId) << ","
-					               << binding.valueRegister << "," << binding.factorRegister << endOfMsg();
-
-				// build request to be sent
-				Byte length = 6;
-				Byte mbapHeader[7];
-				mbapHeader[0] = (lastTransactionId >> 8) & 0xFF;
-				mbapHeader[1] = lastTransactionId & 0xFF;
-				mbapHeader[2] = 0x00;
-				mbapHeader[3] = 0x00;
-				mbapHeader[4] = (length >> 8) & 0xFF;
-				mbapHeader[5] = length & 0xFF;
-				mbapHeader[6] = binding.unitId;
-				int address = binding.firstRegister() - 1;
-				Byte data[4];
-				data[0] = (address >> 8) & 0xFF;
-				data[1] = address & 0xFF;
-				data[2] = 0x00;
-				data[3] = binding.lastRegister() - binding.firstRegister() + 1;
-				ByteString msg = ByteString(mbapHeader, sizeof(mbapHeader)) + ByteString({0x03}) + ByteString(data, sizeof(data));
-
-				// trace request to be sent
-				if (config.getLogRawData())
-					logger.debug() << "S " << cnvToHexStr(msg) << endOfMsg();
-
-				// send request
-				int rc = ::write(socket, msg.data(), msg.length());
-				if (rc < 0)
-					logger.errorX() << unixError("read") << endOfMsg();
-				if (rc == 0)
-					logger.errorX() << "Disconnect by remote party" << endOfMsg();
-
-				// remember request
-				requests[lastTransactionId] = {Clock::now(), bindingPos};
+				range.registerCount = lastRegister - range.firstRegister + 1;
+				continue;
 			}
 		}
+		ranges.push_back(readRange);
+	}
+
+	return ranges;
+}
+
+void Handler::sendRequests()
+{
+	if (devices.empty())
+		return;
+
+	TimePoint now = Clock::now();
+
+	// serve the devices in round robin order with one request per turn until the overall budget is
+	// used up or no device is able to send, so that a slow device can not starve the others
+	std::vector<std::vector<ByteString>> msgs(devices.size());
+	for (std::size_t idleDevices = 0; idleDevices < devices.size(); )
+	{
+		if (config.getMaxRequests() && requestCount >= config.getMaxRequests())
+			break;
+
+		lastDevicePos = (lastDevicePos + 1) % devices.size();
+		auto& device = *devices[lastDevicePos];
+
+		auto unitPos = findSendableUnit(device, now);
+		if (unitPos == device.waitingRanges.end())
+		{
+			idleDevices++;
+			continue;
+		}
+		idleDevices = 0;
+
+		auto& [unitId, ranges] = *unitPos;
+		device.lastUnitId = unitId;
+		msgs[lastDevicePos].push_back(buildReadRequest(device, ranges.front()));
+		ranges.pop_front();
+		device.waitingCount--;
+	}
+
+	// write the requests of each device with as few system calls as possible
+	for (std::size_t pos = 0; pos < devices.size(); pos++)
+	{
+		auto& device = *devices[pos];
+		if (device.fd < 0 || (msgs[pos].empty() && device.outputData.empty()))
+			continue;
+
+		try
+		{
+			writeData(device, msgs[pos]);
+			continue;
+		}
+		catch (const std::exception& ex)
+		{
+			handlerState.errorCounter++;
+
+			logger.error() << ex.what() << endOfMsg();
+		}
+
+		close(device);
+	}
+}
+
+std::map<Byte, std::deque<RegisterRange>>::iterator Handler::findSendableUnit(Device& device, TimePoint now)
+{
+	auto& waitingRanges = device.waitingRanges;
+	if (device.fd < 0 || !device.waitingCount || !device.outputData.empty())
+		return waitingRanges.end();
+
+	// the serial bus carries one request at a time, a TCP connection up to the in-flight limit
+	if (int(device.requests.size()) >= device.maxInFlight)
+		return waitingRanges.end();
+	if (config.isRtu() && device.busFreeTime > now)
+		return waitingRanges.end();
+
+	// serve the units in round robin order, skipping those still turning around
+	auto pos = waitingRanges.upper_bound(device.lastUnitId);
+	for (std::size_t i = 0; i < waitingRanges.size(); i++, pos++)
+	{
+		if (pos == waitingRanges.end())
+			pos = waitingRanges.begin();
+		if (pos->second.empty())
+			continue;
+		if (auto readyPos = device.unitReadyTimes.find(pos->first); readyPos != device.unitReadyTimes.end() && readyPos->second > now)
+			continue;
+		return pos;
+	}
+
+	return waitingRanges.end();
+}
+
+TimePoint Handler::getRtuSendTime(const Device& device) const
+{
+	TimePoint sendTime;
+	if (!config.isRtu() || device.fd < 0 || !device.requests.empty())
+		return sendTime;
+
+	for (auto& [unitId, ranges] : device.waitingRanges)
+		if (!ranges.empty())
+		{
+			TimePoint unitTime = device.busFreeTime;
+			if (auto pos = device.unitReadyTimes.find(unitId); pos != device.unitReadyTimes.end() && pos->second > unitTime)
+				unitTime = pos->second;
+			if (sendTime.isNull() || unitTime < sendTime)
+				sendTime = unitTime;
+		}
+
+	return sendTime;
+}
+
+ByteString Handler::buildReadRequest(Device& device, const RegisterRange& range)
+{
+	// choose transaction id not used by a pending request
+	TransactionId& lastTransactionId = device.lastTransactionId;
+	do
+		lastTransactionId++;
+	while (device.requests.count(lastTransactionId));
+
+	// trace request
+	if (config.getLogMsgs())
+		logger.debug() << "Request " << lastTransactionId << "," << static_cast<int>(range.unitId) << ","
+		               << range.firstRegister << "," << range.registerCount << endOfMsg();
+
+	// build request to be sent
+	int address = range.firstRegister - 1;
+	Byte pdu[5];
+	pdu[0] = 0x03;
+	pdu[1] = (address >> 8) & 0xFF;
+	pdu[2] = address & 0xFF;
+	pdu[3] = 0x00;
+	pdu[4] = range.registerCount;
+	ByteString msg;
+	if (config.isRtu())
+	{
+		msg = ByteString(1, range.unitId) + ByteString(pdu, sizeof(pdu));
+		uint16_t crc = crc16(msg);
+		msg += ByteString({Byte(crc & 0xFF), Byte(crc >> 8)});
+	}
+	else
+	{
+		Byte length = 6;
+		Byte mbapHeader[7];
+		mbapHeader[0] = (lastTransactionId >> 8) & 0xFF;
+		mbapHeader[1] = lastTransactionId & 0xFF;
+		mbapHeader[2] = 0x00;
+		mbapHeader[3] = 0x00;
+		mbapHeader[4] = (length >> 8) & 0xFF;
+		mbapHeader[5] = length & 0xFF;
+		mbapHeader[6] = range.unitId;
+		msg = ByteString(mbapHeader, sizeof(mbapHeader)) + ByteString(pdu, sizeof(pdu));
+	}
+
+	// trace request to be sent
+	if (config.getLogRawData())
+		logger.debug() << "S " << cnvToHexStr(msg) << endOfMsg();
+
+	// remember request
+	TimePoint deadline = Clock::now() + config.getResponseTimeout();
+	device.requests.insert_or_assign(lastTransactionId, Request(deadline, range));
+	device.deadlines.push(Deadline(deadline, lastTransactionId));
+	requestCount++;
+
+	return msg;
+}
+
+void Handler::writeData(Device& device, const std::vector<ByteString>& msgs)
+{
+	auto& outputData = device.outputData;
+
+	// keep the order behind data which could not be written before
+	std::size_t msgPos = 0;
+	if (!outputData.empty())
+		for (; msgPos < msgs.size(); msgPos++)
+			outputData += msgs[msgPos];
+
+	// write the pending data and the messages with as few system calls as possible
+	while (!outputData.empty() || msgPos < msgs.size())
+	{
+		constexpr int maxIovCount = std::min(IOV_MAX, 64);
+		iovec iov[maxIovCount];
+		int iovCount = 0;
+		std::size_t length = 0;
+		if (!outputData.empty())
+		{
+			iov[iovCount++] = {outputData.data(), outputData.length()};
+			length += outputData.length();
+		}
+		std::size_t firstMsgPos = msgPos;
+		for (; msgPos < msgs.size() && iovCount < maxIovCount; msgPos++)
+		{
+			iov[iovCount++] = {const_cast<Byte*>(msgs[msgPos].data()), msgs[msgPos].length()};
+			length += msgs[msgPos].length();
+		}
+
+		ssize_t rc = ::writev(device.fd, iov, iovCount);
+		if (rc < 0)
+			if (errno == EWOULDBLOCK || errno == EAGAIN)
+				rc = 0;
+			else
+				logger.errorX() << unixError("writev") << endOfMsg();
+
+		// remember data not accepted by the socket
+		ByteString unwritten;
+		std::size_t written = rc;
+		if (!outputData.empty())
+		{
+			std::size_t n = std::min(written, outputData.length());
+			unwritten = outputData.substr(n);
+			written -= n;
+		}
+		for (std::size_t i = firstMsgPos; i < msgPos; i++)
+		{
+			std::size_t n = std::min(written, msgs[i].length());
+			unwritten += msgs[i].substr(n);
+			written -= n;
+		}
+		outputData = unwritten;
+
+		// socket buffer full?
+		if (std::size_t(rc) < length)
+		{
+			for (; msgPos < msgs.size(); msgPos++)
+				outputData += msgs[msgPos];
+			return;
+		}
+	}
 }
 
 }
@@ -1,71 +1,226 @@
 #ifndef MODBUS_H
 #define MODBUS_H
 
+#include <queue>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+
 #include "link.h"
+#include "connector.h"
+#include "port.h"
+#include "streambuffer.h"
 #include "logger.h"
 
 namespace modbus
 {
 
+// Maximum number of registers which can be read with one Read Holding Registers request.
+constexpr int MAX_READ_REGISTERS = 125;
+
 class Config
 {
 public:
 	struct Binding
 	{
 		string itemId;
+		string device;
 		Byte unitId;
 		int valueRegister;
 		int valueRegisterCount;
 		int factorRegister;
-		Binding(string itemId, Byte unitId, int valueRegister, int valueRegisterCount, int factorRegister) :
-			itemId(itemId), unitId(unitId), valueRegister(valueRegister),
+		Binding(string itemId, string device, Byte unitId, int valueRegister, int valueRegisterCount, int factorRegister) :
+			itemId(itemId), device(device), unitId(unitId), valueRegister(valueRegister),
 			valueRegisterCount(valueRegisterCount), factorRegister(factorRegister) {};
-		int firstRegister() const { return std::min(valueRegister, factorRegister); }
+		int firstRegister() const { return factorRegister >= 0 ? std::min(valueRegister, factorRegister) : valueRegister; }
 		int lastRegister() const { return std::max(valueRegister + valueRegisterCount - 1, factorRegister); }
+		int registerCount() const { return lastRegister() - firstRegister() + 1; }
 	};
 	class Bindings: public std::map<string, Binding>
 	{
 	public:
 		void add(Binding binding) { insert(value_type(binding.itemId, binding)); }
 	};
+	struct SerialPort
+	{
+		string name;
+		int baudRate;
+		int dataBits;
+		int stopBits;
+		PortConfig::Parity parity;
+		SerialPort() : baudRate(0), dataBits(0), stopBits(0), parity(PortConfig::NONE) {}
+		SerialPort(string name, int baudRate, int dataBits, int stopBits, PortConfig::Parity parity) :
+			name(name), baudRate(baudRate), dataBits(dataBits), stopBits(stopBits), parity(parity) {}
+	};
+	struct Device
+	{
+		// Name referenced by the bindings.
+		string name;
+		string hostname;
+		int port;
+		// Maximum number of requests awaiting a response.
+		int maxInFlight;
+		Device(string name, string hostname, int port, int maxInFlight) :
+			name(name), hostname(hostname), port(port), maxInFlight(maxInFlight) {}
+	};
+	using Devices = std::vector<Device>;
+	using Milliseconds = std::chrono::milliseconds;
 
 private:
-	string hostname;
-	int port;
+	// Modbus TCP servers.
+	Devices devices;
+	// Serial port used instead of a TCP connection (Modbus RTU). Not used if its name is empty.
+	SerialPort serialPort;
+	// Modbus RTU: Minimum delay between a response of a unit and the next request to the same unit.
+	Milliseconds turnaroundDelay;
+	std::map<Byte, Milliseconds> unitTurnaroundDelays;
 	Seconds reconnectInterval;
+	Seconds connectTimeout;
 	Seconds responseTimeout = 5s;
+	// Maximum number of unused registers between two bindings whose reads are merged into one request.
+	int maxRegisterGap;
+	// Maximum number of requests awaiting a response over all devices.
+	int maxRequests;
+	// Maximum age of cached register values used for answering read requests (0 = no caching).
+	Seconds maxCacheAge;
 	bool logRawData;
 	bool logMsgs;
 	Bindings bindings;
 
 public:
-	Config(string hostname, int port,  Seconds reconnectInterval,
-		bool logRawData, bool logMsgs, Bindings bindings) :
-		hostname(hostname), port(port), reconnectInterval(reconnectInterval),
-		logRawData(logRawData), logMsgs(logMsgs), bindings(bindings)
+	Config(Devices devices, SerialPort serialPort, Milliseconds turnaroundDelay,
+		std::map<Byte, Milliseconds> unitTurnaroundDelays, Seconds reconnectInterval, Seconds connectTimeout,
+		int maxRegisterGap, int maxRequests, Seconds maxCacheAge, bool logRawData, bool logMsgs, Bindings bindings) :
+		devices(devices), serialPort(serialPort), turnaroundDelay(turnaroundDelay),
+		unitTurnaroundDelays(unitTurnaroundDelays), reconnectInterval(reconnectInterval), connectTimeout(connectTimeout), maxRegisterGap(maxRegisterGap),
+		maxRequests(maxRequests), maxCacheAge(maxCacheAge), logRawData(logRawData), logMsgs(logMsgs), bindings(bindings)
 	{}
-	string getHostname() const { return hostname; }
-	int getPort() const { return port; }
+	const Devices& getDevices() const { return devices; }
+	bool isRtu() const { return serialPort.name != ""; }
+	const SerialPort& getSerialPort() const { return serialPort; }
+	Milliseconds getTurnaroundDelay(Byte unitId) const
+	{
+		auto pos = unitTurnaroundDelays.find(unitId);
+		return pos != unitTurnaroundDelays.end() ? pos->second : turnaroundDelay;
+	}
 	Seconds getReconnectInterval() const { return reconnectInterval; }
+	Seconds getConnectTimeout() const { return connectTimeout; }
 	Seconds getResponseTimeout() const { return responseTimeout; }
+	int getMaxRegisterGap() const { return maxRegisterGap; }
+	int getMaxRequests() const { return maxRequests; }
+	Seconds getMaxCacheAge() const { return maxCacheAge; }
 	bool getLogRawData() const { return logRawData; }
 	bool getLogMsgs() const { return logMsgs; }
 	const Bindings& getBindings() const { return bindings; }
 };
 
+// Consecutive registers of a unit read with one request.
+struct RegisterRange
+{
+	Byte unitId;
+	int firstRegister;
+	int registerCount;
+	RegisterRange(Byte unitId, int firstRegister, int registerCount) :
+		unitId(unitId), firstRegister(firstRegister), registerCount(registerCount) {}
+	int lastRegister() const { return firstRegister + registerCount - 1; }
+	bool covers(const RegisterRange& range) const
+	{
+		return range.unitId == unitId && range.firstRegister >= firstRegister && range.lastRegister() <= lastRegister();
+	}
+	bool overlaps(const Config::Binding& binding) const
+	{
+		return binding.unitId == unitId && binding.firstRegister() <= lastRegister() && binding.lastRegister() >= firstRegister;
+	}
+};
+using RegisterRanges = std::vector<RegisterRange>;
+
 class Handler: public HandlerIf
 {
 private:
+	using TransactionId = uint16_t;
+
+	struct Request
+	{
+		TimePoint deadline;
+		RegisterRange range;
+		Request(TimePoint deadline, RegisterRange range) : deadline(deadline), range(range) {}
+	};
+
+	// Response deadline of a request.
+	using Deadline = std::pair<TimePoint, TransactionId>;
+
+	struct CachedRegister
+	{
+		uint16_t value;
+		TimePoint time; // time of receipt
+	};
+
+	// Connection to a Modbus TCP server or to the serial bus (Modbus RTU).
+	struct Device
+	{
+		// Name referenced by the bindings and name used for logging.
+		string name;
+		string displayName;
+
+		int maxInFlight;
+		TcpConnector connector;
+
+		// Socket or serial port (Modbus RTU) file descriptor.
+		int fd;
+		struct termios oldSettings;
+
+		TimePoint lastConnectTry;
+		TimePoint lastDataReceipt;
+		StreamBuffer streamData;
+
+		// Data not yet accepted by the socket.
+		ByteString outputData;
+
+		TransactionId lastTransactionId;
+
+		// Requests awaiting a response.
+		std::unordered_map<TransactionId, Request> requests;
+
+		// Response deadlines of the requests, earliest first. Entries of requests which have already
+		// been answered are skipped when they reach the top.
+		std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> deadlines;
+
+		// Register ranges per unit waiting to be sent.
+		std::map<Byte, std::deque<RegisterRange>> waitingRanges;
+		int waitingCount;
+
+		// Modbus RTU: Time from which on the bus is free for the next request (inter-frame silence).
+		TimePoint busFreeTime;
+
+		// Modbus RTU: Time per unit from which on it accepts the next request (turnaround delay).
+		std::map<Byte, TimePoint> unitReadyTimes;
+
+		// Unit which has been sent the last request.
+		Byte lastUnitId;
+
+		// Bindings per unit ordered by their first register.
+		std::map<Byte, std::vector<const Config::Binding*>> unitBindings;
+
+		// Image of the received registers per unit.
+		std::map<Byte, std::unordered_map<int, CachedRegister>> registerCache;
+
+		Device(string name, string displayName, string hostname, int port, int maxInFlight, Seconds connectTimeout) :
+			name(name), displayName(displayName), maxInFlight(maxInFlight), connector(hostname, port, connectTimeout),
+			fd(-1), lastTransactionId(0), waitingCount(0), lastUnitId(0) {}
+	};
+
 	string id;
 	Config config;
 	Logger logger;
-	ByteString streamData;
-	int socket = -1;
-	Byte lastTransactionId = 0;
-	TimePoint lastConnectTry;
-	TimePoint lastDataReceipt;
 	HandlerState handlerState;
-	std::map<Byte, std::pair<TimePoint, Config::Bindings::const_iterator>> requests;
+
+	std::vector<std::unique_ptr<Device>> devices;
+
+	// Device served last by the request scheduler.
+	std::size_t lastDevicePos = 0;
+
+	// Number of requests awaiting a response over all devices.
+	int requestCount = 0;
 
 public:
 	Handler(string id, Config config, Logger logger);
@@ -77,11 +232,29 @@ public:
 	virtual Events send(const Items& items, const Events& events) override;
 
 private:
-	bool open();
-	void close();	
-	Events receiveX(const Items& items);
-	void receiveData();
-	void sendX(const Items& items, const Events& events);
+	bool open(Device& device);
+	bool openSerialPort(Device& device);
+	void close(Device& device);
+	void updateState();
+	void receiveX(Device& device, const Items& items, Events& events);
+	void receiveData(Device& device);
+	void processTcpResponses(Device& device, const Items& items, Events& events);
+	void processRtuResponses(Device& device, const Items& items, Events& events);
+	void processResponse(Device& device, const Items& items, const RegisterRange& range, ByteView msg, ByteView data, Events& events);
+	void finishRequest(Device& device, std::unordered_map<TransactionId, Request>::iterator requestPos);
+	void processExpiredRequests(Device& device);
+	Device* findDevice(const string& name) const;
+	RegisterRanges getStaleRanges(const Device& device, const Config::Binding& binding, TimePoint minTime) const;
+	bool isPending(const Device& device, const RegisterRange& range) const;
+	RegisterRanges planReads(RegisterRanges readRanges) const;
+	void sendRequests();
+	std::map<Byte, std::deque<RegisterRange>>::iterator findSendableUnit(Device& device, TimePoint now);
+	TimePoint getRtuSendTime(const Device& device) const;
+	ByteString buildReadRequest(Device& device, const RegisterRange& range);
+	void writeData(Device& device, const std::vector<ByteString>& msgs);
+	void cacheRegisters(Device& device, const RegisterRange& range, ByteView data, TimePoint time);
+	void addEvents(const Device& device, const Items& items, const RegisterRange& range, TimePoint minTime, Events& events) const;
+	void addEvent(const Device& device, const Items& items, const Config::Binding& binding, Events& events) const;
 };
 
 }
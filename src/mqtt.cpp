@@ -1,7 +1,10 @@
 #include <sstream>
 #include <cstring>
 #include <stdexcept>
+#include <algorithm>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <thread>
 
 #include "mqtt.h"
 #include "finally.h"
@@ -58,14 +61,198 @@ TopicPattern TopicPattern::fromStr(const string& topicPatternStr)
 	return TopicPattern(topicPatternStr);
 }
 
+PubTopic::PubTopic(const string& topicStr) : topicStr(topicStr), rendered(false)
+{
+	string::size_type curr = 0;
+	for (;;)
+	{
+		auto begin = topicStr.find('%', curr);
+		auto end = begin == string::npos ? string::npos : topicStr.find('%', begin + 1);
+		if (end == string::npos)
+		{
+			if (curr < topicStr.length())
+				segments.emplace_back(topicStr.substr(curr), false);
+			break;
+		}
+
+		if (begin > curr)
+			segments.emplace_back(topicStr.substr(curr, begin - curr), false);
+		segments.emplace_back(topicStr.substr(begin + 1, end - begin - 1), true);
+		curr = end + 1;
+	}
+
+	for (auto& segment : segments)
+		if (segment.isItemId)
+			values.push_back(Value());
+}
+
+const string* PubTopic::render(const Items& items)
+{
+	bool changed = !rendered;
+	int i = 0;
+	for (auto& segment : segments)
+		if (segment.isItemId)
+		{
+			const Value& value = items.get(segment.text).getLastValue();
+			if (!value.isString() && !value.isNumber())
+			{
+				// values may be partly updated, hence render again next time
+				rendered = false;
+				return nullptr;
+			}
+			if (!(value == values[i]))
+			{
+				values[i] = value;
+				changed = true;
+			}
+			i++;
+		}
+	if (!changed)
+		return &topic;
+
+	topic.clear();
+	i = 0;
+	for (auto& segment : segments)
+		if (!segment.isItemId)
+			topic += segment.text;
+		else if (values[i].isString())
+			topic += values[i++].getString();
+		else
+			topic += cnvToStr(values[i++].getNumber());
+	rendered = true;
+	return &topic;
+}
+
+void MsgQueue::push(const Msg& msg)
+{
+	if (msg.retainFlag)
+		if (auto pos = retainedMsgs.find(msg.topic); pos != retainedMsgs.end())
+		{
+			pos->second->payload = msg.payload;
+			pos->second->time = msg.time;
+			return;
+		}
+
+	if (msgs.size() >= maxSize)
+	{
+		droppedMsgs++;
+		if (dropPolicy == Config::DROP_NEWEST)
+			return;
+		pop();
+	}
+
+	msgs.push_back(msg);
+	if (msg.retainFlag)
+		retainedMsgs[msg.topic] = std::prev(msgs.end());
+}
+
+void MsgQueue::pop()
+{
+	if (msgs.front().retainFlag)
+		retainedMsgs.erase(msgs.front().topic);
+	msgs.pop_front();
+}
+
+string TopicTree::getFilter(const string& topicFilter)
+{
+	static const string sharePrefix = "$share/";
+	if (topicFilter.compare(0, sharePrefix.length(), sharePrefix) != 0)
+		return topicFilter;
+	string::size_type pos = topicFilter.find('/', sharePrefix.length());
+	return pos == string::npos ? topicFilter : topicFilter.substr(pos + 1);
+}
+
+void TopicTree::add(const string& sharedTopicFilter, Subscriber subscriber)
+{
+	// messages of shared subscriptions are delivered with the plain topic
+	string topicFilter = getFilter(sharedTopicFilter);
+
+	Node* node = &root;
+	string::size_type begin = 0;
+	for (;;)
+	{
+		string::size_type end = topicFilter.find('/', begin);
+		string level = topicFilter.substr(begin, end == string::npos ? string::npos : end - begin);
+
+		auto& child = node->children[level];
+		if (!child)
+			child.reset(new Node);
+		node = child.get();
+
+		if (end == string::npos)
+			break;
+		begin = end + 1;
+	}
+	node->subscribers.push_back(subscriber);
+}
+
+void TopicTree::match(const string& topic, Subscribers& subscribers) const
+{
+	collect(root, topic, true, subscribers);
+}
+
+void TopicTree::collect(const Node& node, std::string_view topic, bool firstLevel, Subscribers& subscribers) const
+{
+	// + and # do not match topics starting with $ on the first level
+	bool wildcards = !firstLevel || topic.empty() || topic[0] != '$';
+
+	auto end = topic.find('/');
+	std::string_view level = topic.substr(0, end);
+
+	auto collectChild = [&](std::string_view key)
+	{
+		auto pos = node.children.find(key);
+		if (pos == node.children.end())
+			return;
+		const Node& child = *pos->second;
+		if (end == std::string_view::npos)
+		{
+			subscribers.insert(subscribers.end(), child.subscribers.begin(), child.subscribers.end());
+
+			// a/# matches also a
+			if (auto hashPos = child.children.find("#"); hashPos != child.children.end())
+				subscribers.insert(subscribers.end(), hashPos->second->subscribers.begin(), hashPos->second->subscribers.end());
+		}
+		else
+			collect(child, topic.substr(end + 1), false, subscribers);
+	};
+
+	collectChild(level);
+	if (wildcards)
+	{
+		collectChild("+");
+		if (auto pos = node.children.find("#"); pos != node.children.end())
+			subscribers.insert(subscribers.end(), pos->second->subscribers.begin(), pos->second->subscribers.end());
+	}
+}
+
 void onConnect(struct mosquitto* client, void* handler, int rc)
 {
 	static_cast<Handler*>(handler)->onConnect(rc);
 }
 
+void onConnectV5(struct mosquitto* client, void* handler, int rc, int flags, const mosquitto_property* props)
+{
+	uint16_t topicAliasMax = 0;
+	if (props)
+		mosquitto_property_read_int16(props, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &topicAliasMax, false);
+	static_cast<Handler*>(handler)->topicAliasMax = topicAliasMax;
+	static_cast<Handler*>(handler)->onConnect(rc);
+}
+
+void onSubscribe(struct mosquitto* client, void* handler, int mid, int qosCount, const int* grantedQos)
+{
+	static_cast<Handler*>(handler)->onSubscribe();
+}
+
+void onDisconnect(struct mosquitto* client, void* handler, int rc)
+{
+	static_cast<Handler*>(handler)->onDisconnect(rc);
+}
+
 void onMessage(struct mosquitto* client, void* handler, const struct mosquitto_message* msg)
 {
-	static_cast<Handler*>(handler)->onMessage(Handler::Msg(msg->topic, string(static_cast<char*>(msg->payload), msg->payloadlen), false));
+	static_cast<Handler*>(handler)->onMessage(Msg(msg->topic, SharedString(static_cast<char*>(msg->payload), msg->payloadlen), msg->retain));
 }
 
 void onLog(struct mosquitto* client, void* handler, int level, const char* msg)
@@ -74,10 +261,26 @@ void onLog(struct mosquitto* client, void* handler, int level, const char* msg)
 }
 
 Handler::Handler(string id, Config config, Logger logger) :
-	id(id), config(config), logger(logger), client(0), state(DISCONNECTED),
-	lastConnectTry(0), lastMsgSendTime(0)
+	state(DISCONNECTED), id(id), config(config), logger(logger), client(0),
+	lastConnectTry(0), lastMsgSendTime(0),
+	mainThreadId(std::this_thread::get_id()), eventFd(-1), threadMsgs(4096), threadLogs(256),
+	connectRc(-1), connectionLost(false), topicAliasMax(0),
+	warmStarting(config.getWarmStart()), pendingSubAcks(0), warmStartBegin(0),
+	waitingMsgs(config.getMaxQueuedMsgs(), config.getDropPolicy())
 {
 	handlerState.errorCounter = 0;
+	handlerState.metrics["queuedMsgs"] = 0;
+	handlerState.metrics["droppedMsgs"] = 0;
+
+	for (auto& [itemId, binding] : this->config.getBindings())
+	{
+		for (auto& topic : binding.stateTopics)
+			topicTree.add(topic, TopicTree::Subscriber(&binding, TopicTree::STATE_TOPIC));
+		if (binding.readTopic != "")
+			topicTree.add(binding.readTopic, TopicTree::Subscriber(&binding, TopicTree::READ_TOPIC));
+		if (binding.writeTopic != "")
+			topicTree.add(binding.writeTopic, TopicTree::Subscriber(&binding, TopicTree::WRITE_TOPIC));
+	}
 
 	mosquitto_lib_init();
 
@@ -86,10 +289,22 @@ Handler::Handler(string id, Config config, Logger logger) :
 	if (!client)
 		logger.errorX() << "Function mosquitto_new() returned null" << endOfMsg();
 
-	mosquitto_connect_callback_set(client, mqtt::onConnect);
+	if (config.getMqtt5())
+		mosquitto_connect_v5_callback_set(client, mqtt::onConnectV5);
+	else
+		mosquitto_connect_callback_set(client, mqtt::onConnect);
+	mosquitto_disconnect_callback_set(client, mqtt::onDisconnect);
 	mosquitto_message_callback_set(client, mqtt::onMessage);
+	mosquitto_subscribe_callback_set(client, mqtt::onSubscribe);
 	mosquitto_log_callback_set(client, mqtt::onLog);
 
+	if (config.getThreadedLoop())
+	{
+		eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (eventFd == -1)
+			logger.errorX() << unixError("eventfd") << endOfMsg();
+	}
+
 	int major, minor, revision;
 	mosquitto_lib_version(&major, &minor, &revision);
 	logger.info() << "Using Mosquitto library version " << major << "." << minor << "." << revision << endOfMsg();
@@ -98,6 +313,8 @@ Handler::Handler(string id, Config config, Logger logger) :
 Handler::~Handler()
 {
 	disconnect();
+	if (eventFd != -1)
+		close(eventFd);
 
 	mosquitto_destroy(client);
 	mosquitto_lib_cleanup();
@@ -155,6 +372,30 @@ void Handler::validate(Items& items)
 		validateTopic(binding.writeTopic);
 		validateTopic(binding.readTopic);
 	}
+
+	// compile publish topics, binding topics override the default ones
+	for (auto& [itemId, item] : items)
+	{
+		auto bindingPos = bindings.find(itemId);
+		auto* binding = bindingPos != bindings.end() ? &bindingPos->second : nullptr;
+
+		auto addTopics = [&](EventType eventType, const TopicPattern& topicPattern, const Config::Topics& topics)
+		{
+			PubTopics& itemTopics = pubTopics[eventType][itemId];
+			itemTopics.clear();
+			if (topics.size())
+				for (auto& topic : topics)
+					itemTopics.emplace_back(TopicTree::getFilter(topic));
+			else if (!topicPattern.isNull())
+				itemTopics.emplace_back(topicPattern.createPubTopic(itemId));
+			if (itemTopics.empty())
+				pubTopics[eventType].erase(itemId);
+		};
+		auto toTopics = [](const string& topic) { return topic.empty() ? Config::Topics() : Config::Topics{topic}; };
+		addTopics(EventType::STATE_IND, config.getOutStateTopicPattern(), binding ? binding->stateTopics : Config::Topics());
+		addTopics(EventType::WRITE_REQ, config.getOutWriteTopicPattern(), toTopics(binding ? binding->writeTopic : ""));
+		addTopics(EventType::READ_REQ, config.getOutReadTopicPattern(), toTopics(binding ? binding->readTopic : ""));
+	}
 }
 
 void Handler::disconnect()
@@ -172,20 +413,42 @@ void Handler::disconnect()
 		lastConnectTry = std::time(0);
 
 	mosquitto_disconnect(client);
+	handlerState.operational = false;
+	if (config.getThreadedLoop())
+	{
+		// the network thread terminates after the disconnect
+		int ec = mosquitto_loop_stop(client, false);
+		if (ec != MOSQ_ERR_SUCCESS && ec != MOSQ_ERR_NO_CONN)
+			logger.error() << "Function mosquitto_loop_stop() returned error " << ec << " (" << mosquitto_strerror(ec) << ")" << endOfMsg();
+		receiveThreadData();
+	}
 	state = DISCONNECTED;
-	waitingMsgs.clear();
+	connectRc = -1;
+	connectionLost = false;
 }
 
 long Handler::collectFds(fd_set* readFds, fd_set* writeFds, fd_set* excpFds, int* maxFd)
 {
-	int socket = mosquitto_socket(client);
+	int socket = config.getThreadedLoop() ? eventFd : mosquitto_socket(client);
 	if (socket >= 0)
 	{
 		FD_SET(socket, readFds);
 		*maxFd = std::max(*maxFd, socket);
 	}
-	return mosquitto_want_write(client) || state == CONNECTING_SUCCEEDED
-		|| state == CONNECTING_FAILED || waitingMsgs.size() ? 0 : -1;
+	// wait until pending data (including the CONNECT packet of a connect in progress) can be written
+	if (socket >= 0 && !config.getThreadedLoop() && mosquitto_want_write(client))
+		FD_SET(socket, writeFds);
+	if (state == CONNECTING_SUCCEEDED || state == CONNECTING_FAILED || (state == CONNECTED && waitingMsgs.size()))
+		return 0;
+
+	// check regularly whether the warm start has completed
+	if (state == CONNECTED && warmStarting)
+		return 100;
+
+	// wake up for the next connect attempt in order to deliver the waiting messages
+	if (state == DISCONNECTED && waitingMsgs.size())
+		return std::max(lastConnectTry + config.getReconnectInterval() - std::time(0), std::time_t(0)) * 1000;
+	return -1;
 }
 
 void Handler::handleError(const string& funcName, int errorCode)
@@ -222,24 +485,95 @@ void Handler::onLog(int level, const string& text)
 			levelStr = "???"; break;
 	}
 
+	// the logger must only be used by the main thread
+	if (std::this_thread::get_id() != mainThreadId)
+	{
+		if (threadLogs.push(text + " (" + levelStr + ")"))
+			notifyMainLoop();
+		return;
+	}
+
 	logger.debug() << text << " (" << levelStr << ")" << endOfMsg();
 }
 
 void Handler::onConnect(int rc)
 {
-	if (state == CONNECTING)
-		if (rc == 0)
-			state = CONNECTING_SUCCEEDED;
-		else
-			state = CONNECTING_FAILED;
+	connectRc = rc;
+	notifyMainLoop();
 }
 
-void Handler::onMessage(const Msg& msg)
+void Handler::onDisconnect(int rc)
 {
+	// rc 0 indicates a disconnect requested by the handler itself
+	if (rc != 0)
+	{
+		connectionLost = true;
+		notifyMainLoop();
+	}
+}
+
+void Handler::onMessage(Msg&& msg)
+{
+	if (config.getThreadedLoop())
+	{
+		// wait for the main thread in case it is lagging behind
+		while (!threadMsgs.push(std::move(msg)))
+			std::this_thread::yield();
+		notifyMainLoop();
+		return;
+	}
+
 	if (config.getLogMsgs())
 		logger.debug() << "R " << msg.topic << ": " << msg.payload << endOfMsg();
 
-	receivedMsgs.push_back(msg);
+	receivedMsgs.push_back(std::move(msg));
+}
+
+void Handler::onSubscribe()
+{
+	pendingSubAcks--;
+	notifyMainLoop();
+}
+
+void Handler::subscribe(const string& topic)
+{
+	pendingSubAcks++;
+	int ec = mosquitto_subscribe(client, 0, topic.c_str(), 0);
+	handleError("mosquitto_subscribe", ec);
+}
+
+Events Handler::takeSnapshot()
+{
+	Events events;
+	if (!warmStarting)
+		events.swap(snapshot);
+	return events;
+}
+
+void Handler::notifyMainLoop()
+{
+	if (eventFd == -1)
+		return;
+	uint64_t value = 1;
+	while (write(eventFd, &value, sizeof(value)) == -1 && errno == EINTR);
+}
+
+void Handler::receiveThreadData()
+{
+	uint64_t value;
+	while (read(eventFd, &value, sizeof(value)) == -1 && errno == EINTR);
+
+	string text;
+	while (threadLogs.pop(text))
+		logger.debug() << text << endOfMsg();
+
+	Msg msg;
+	while (threadMsgs.pop(msg))
+	{
+		if (config.getLogMsgs())
+			logger.debug() << "R " << msg.topic << ": " << msg.payload << endOfMsg();
+		receivedMsgs.push_back(std::move(msg));
+	}
 }
 
 Events Handler::receive(const Items& items)
@@ -273,7 +607,7 @@ Events Handler::receiveX(const Items& items)
 			return events;
 		lastConnectTry = now;
 
-		int value = MQTT_PROTOCOL_V311;
+		int value = config.getMqtt5() ? MQTT_PROTOCOL_V5 : MQTT_PROTOCOL_V311;
 		int ec = mosquitto_opts_set(client, MOSQ_OPT_PROTOCOL_VERSION, &value);
 		handleError("mosquitto_opts_set#1", ec);
 
@@ -302,15 +636,37 @@ Events Handler::receiveX(const Items& items)
 			//handleError("mosquitto_tls_insecure_set", ec);
 		}
 
-		ec = mosquitto_connect(client, config.getHostname().c_str(), config.getPort(), 60);
-		handleError("mosquitto_connect", ec);
+		// the TCP connect completes in the loop and is confirmed by the CONNACK callback
+		ec = mosquitto_connect_async(client, config.getHostname().c_str(), config.getPort(), 60);
+		handleError("mosquitto_connect_async", ec);
 
 		state = CONNECTING;
 		receivedMsgs.clear();
+		topicAliasMax = 0;
+		topicStats.clear();
+		aliasTopics.clear();
+
+		if (config.getThreadedLoop())
+		{
+			ec = mosquitto_loop_start(client);
+			handleError("mosquitto_loop_start", ec);
+		}
 	}
 
-	int ec = mosquitto_loop(client, 0, 1);
-	handleError("mosquitto_loop#1", ec);
+	if (config.getThreadedLoop())
+	{
+		receiveThreadData();
+		if (connectionLost)
+			logger.errorX() << "Connection to MQTT broker lost" << endOfMsg();
+	}
+	else
+	{
+		int ec = mosquitto_loop(client, 0, 1);
+		handleError("mosquitto_loop#1", ec);
+	}
+
+	if (int rc = connectRc.exchange(-1); rc != -1 && state == CONNECTING)
+		state = rc == 0 ? CONNECTING_SUCCEEDED : CONNECTING_FAILED;
 
 	if (state == CONNECTING_SUCCEEDED)
 	{
@@ -318,6 +674,14 @@ Events Handler::receiveX(const Items& items)
 
 		logger.info() << "Connected to MQTT broker " << config.getHostname() << ":" << config.getPort() << endOfMsg();
 
+		pendingSubAcks = 0;
+		if (warmStarting)
+		{
+			warmStartBegin = std::time(0);
+			lastRetainedMsg = Stopwatch();
+			snapshot.clear();
+		}
+
 		std::unordered_set<string> topics;
 		for (auto& [itemId, binding] : config.getBindings())
 			if (items.getOwnerId(itemId) == id)
@@ -330,31 +694,25 @@ Events Handler::receiveX(const Items& items)
 					topics.insert(binding.readTopic);
 			}
 		for (const string& topic : topics)
-		{
-			int ec = mosquitto_subscribe(client, 0, topic.c_str(), 0);
-			handleError("mosquitto_subscribe", ec);
-		}
+			subscribe(topic);
 
-		auto subscribe = [&](const TopicPattern& topicPattern)
-		{
-			if (topicPattern.isNull())
-				return;
-			int ec = mosquitto_subscribe(client, 0, topicPattern.createSubTopicPattern().c_str(), 0);
-			handleError("mosquitto_subscribe", ec);
-		};
-		subscribe(config.getInStateTopicPattern());
-		subscribe(config.getInWriteTopicPattern());
-		subscribe(config.getInReadTopicPattern());
+		for (auto topicPattern : {config.getInStateTopicPattern(), config.getInWriteTopicPattern(), config.getInReadTopicPattern()})
+			if (!topicPattern.isNull())
+				subscribe(topicPattern.createSubTopicPattern());
 
 		for (auto& topic : config.getSubTopics())
+			subscribe(topic);
+	}
+
+	// send waiting messages batchwise to avoid blocking the main loop after a long outage
+	if (state == CONNECTED && waitingMsgs.size())
+	{
+		for (int i = 0; i < config.getFlushBatchSize() && waitingMsgs.size(); i++)
 		{
-			int ec = mosquitto_subscribe(client, 0, topic.c_str(), 0);
-			handleError("mosquitto_subscribe", ec);
+			sendMessage(waitingMsgs.front());
+			waitingMsgs.pop();
 		}
-
-		for (auto& msg : waitingMsgs)
-			sendMessage(msg.topic, msg.payload, msg.retainFlag);
-		waitingMsgs.clear();
+		handlerState.metrics["queuedMsgs"] = waitingMsgs.size();
 	}
 
 	if (state == CONNECTED && config.getIdleTimeout() && lastMsgSendTime + config.getIdleTimeout() <= std::time(0))
@@ -363,38 +721,58 @@ Events Handler::receiveX(const Items& items)
 		return events;
 	}
 
-	auto& bindings = config.getBindings();
+	TopicTree::Subscribers subscribers;
+	Events retainedEvents;
 	for (auto& msg : receivedMsgs)
 	{
+		// during warm start the events of retained messages are checked for the snapshot
+		Events& msgEvents = warmStarting && msg.retainFlag ? retainedEvents : events;
+		if (warmStarting && msg.retainFlag)
+			lastRetainedMsg = Stopwatch();
+
 		// try explicit matching
-		int eventCount = events.size();
-		for (auto& [itemId, binding] : bindings)
-			if (std::regex_search(msg.payload, binding.msgPattern))
+		int eventCount = msgEvents.size();
+		subscribers.clear();
+		topicTree.match(msg.topic, subscribers);
+
+		// group subscribers by binding with read before write topic
+		std::sort(subscribers.begin(), subscribers.end(), [](const TopicTree::Subscriber& s1, const TopicTree::Subscriber& s2)
+			{ return s1.binding < s2.binding || (s1.binding == s2.binding && s1.topicType < s2.topicType); });
+		for (auto pos = subscribers.begin(); pos != subscribers.end();)
+		{
+			auto& binding = *pos->binding;
+			auto end = pos;
+			while (end != subscribers.end() && end->binding == &binding)
+				end++;
+
+			if (binding.anyMsg || std::regex_search(msg.payload.get(), binding.msgPattern))
 			{
-				auto matches = [&](const string& topicPattern)
-				{
-					bool result;
-					int ec = mosquitto_topic_matches_sub(topicPattern.c_str(), msg.topic.c_str(), &result);
-					handleError("mosquitto_topic_matches_sub", ec);
-					return result;
-				};
-				if (items.getOwnerId(itemId) == id)
+				if (items.getOwnerId(binding.itemId) == id)
 				{
-					for (auto& topicPattern : binding.stateTopics)
-						if (matches(topicPattern))
-							events.add(Event(id, itemId, EventType::STATE_IND, Value::newString(msg.payload)));
+					for (; pos != end; pos++)
+						if (pos->topicType == TopicTree::STATE_TOPIC)
+							msgEvents.add(Event(id, binding.itemId, EventType::STATE_IND, Value::newString(msg.payload)));
 				}
 				else
-					if (binding.readTopic != "" && matches(binding.readTopic))
-						events.add(Event(id, itemId, EventType::READ_REQ, Value()));
-					else if (binding.writeTopic != "" && matches(binding.writeTopic))
-						events.add(Event(id, itemId, EventType::WRITE_REQ, Value::newString(msg.payload)));
+					for (; pos != end; pos++)
+						if (pos->topicType == TopicTree::READ_TOPIC)
+						{
+							msgEvents.add(Event(id, binding.itemId, EventType::READ_REQ, Value()));
+							break;
+						}
+						else if (pos->topicType == TopicTree::WRITE_TOPIC)
+						{
+							msgEvents.add(Event(id, binding.itemId, EventType::WRITE_REQ, Value::newString(msg.payload)));
+							break;
+						}
 			}
-		if (events.size() > eventCount)
+			pos = end;
+		}
+		if (msgEvents.size() > eventCount)
 			continue;
 
 		// try implicit matching
-		eventCount = events.size();
+		eventCount = msgEvents.size();
 		string itemId;
 		auto getItemId = [&](const TopicPattern& topicPattern)
 		{
@@ -406,16 +784,33 @@ Events Handler::receiveX(const Items& items)
 			return true;
 		};
 		if (getItemId(config.getInStateTopicPattern()))
-			events.add(Event(id, itemId, EventType::STATE_IND, Value::newString(msg.payload)));
+			msgEvents.add(Event(id, itemId, EventType::STATE_IND, Value::newString(msg.payload)));
 		else if (getItemId(config.getInWriteTopicPattern()))
-			events.add(Event(id, itemId, EventType::WRITE_REQ, Value::newString(msg.payload)));
+			msgEvents.add(Event(id, itemId, EventType::WRITE_REQ, Value::newString(msg.payload)));
 		else if (getItemId(config.getInReadTopicPattern()))
-			events.add(Event(id, itemId, EventType::READ_REQ, Value::newVoid()));
+			msgEvents.add(Event(id, itemId, EventType::READ_REQ, Value::newVoid()));
 		else
 			logger.warn() << "Unable to handle message " << msg.payload << " received on topic " << msg.topic << endOfMsg();
 	}
 	receivedMsgs.clear();
 
+	for (auto& event : retainedEvents)
+		if (event.getType() == EventType::STATE_IND)
+			snapshot.add(event);
+		else
+			events.add(event);
+
+	if (  state == CONNECTED && warmStarting
+	   && (  (pendingSubAcks <= 0 && lastRetainedMsg.getRuntime() > 200)
+	      || warmStartBegin + config.getWarmStartTimeout() <= std::time(0)
+	      )
+	   )
+	{
+		warmStarting = false;
+		logger.info() << "Warm start completed with " << snapshot.size() << " retained values" << endOfMsg();
+	}
+	handlerState.operational = state == CONNECTED && !warmStarting;
+
 	return events;
 }
 
@@ -439,106 +834,30 @@ Events Handler::send(const Items& items, const Events& events)
 
 void Handler::sendX(const Items& items, const Events& events)
 {
-	auto sendMsg = [&](const string& topic, const string& payload, bool retainFlag)
+	auto sendMsg = [&](const string& topic, const SharedString& payload, bool retainFlag)
 	{
-		if (state != CONNECTED)
+		// keep order behind waiting messages which are still to be flushed
+		if (state == CONNECTED && waitingMsgs.empty())
+			sendMessage(Msg(topic, payload, retainFlag));
+		else if (state == CONNECTED || config.getIdleTimeout())
 		{
-			if (config.getIdleTimeout())
-				waitingMsgs.push_back(Msg(topic, payload, retainFlag));
+			waitingMsgs.push(Msg(topic, payload, retainFlag));
+			handlerState.metrics["queuedMsgs"] = waitingMsgs.size();
+			handlerState.metrics["droppedMsgs"] = waitingMsgs.getDroppedMsgs();
 		}
-		else
-			sendMessage(topic, payload, retainFlag);
 	};
 
-	auto& bindings = config.getBindings();
 	for (auto& event : events)
 	{
 		string itemId = event.getItemId();
 
-		// determine default topics
-		std::unordered_set<string> topics;
-		if (event.getType() == EventType::STATE_IND)
-		{
-			if (!config.getOutStateTopicPattern().isNull())
-				topics = {config.getOutStateTopicPattern().createPubTopic(itemId)};
-		}
-		else if (event.getType() == EventType::WRITE_REQ)
-		{
-			if (!config.getOutWriteTopicPattern().isNull())
-				topics = {config.getOutWriteTopicPattern().createPubTopic(itemId)};
-		}
-		else if (event.getType() == EventType::READ_REQ)
-		{
-			if (!config.getOutReadTopicPattern().isNull())
-				topics = {config.getOutReadTopicPattern().createPubTopic(itemId)};
-		}
-
-		// override topics
-		auto bindingPos = bindings.find(itemId);
-		if (bindingPos != bindings.end())
-		{
-			auto& binding = bindingPos->second;
-
-			if (event.getType() == EventType::STATE_IND)
-			{
-				if (binding.stateTopics.size())
-					topics = binding.stateTopics;
-			}
-			else if (event.getType() == EventType::WRITE_REQ)
-			{
-				if (binding.writeTopic != "")
-					topics = {binding.writeTopic};
-			}
-			else if (event.getType() == EventType::READ_REQ)
-			{
-				if (binding.readTopic != "")
-					topics = {binding.readTopic};
-			}
-		}
-
 		// skip events for those no topic has been found
-		if (!topics.size())
+		auto topicsPos = pubTopics[event.getType()].find(itemId);
+		if (topicsPos == pubTopics[event.getType()].end())
 			continue;
 
-		// replace item ids by item values inside topics
-		std::unordered_set<string> newTopics;
-		for (string topic : topics)
-		{
-			string::size_type curr = 0;
-			for (;;)
-			{
-				auto begin = topic.find('%', curr);
-				if (begin == string::npos)
-				{
-					newTopics.insert(topic);
-					break;
-				}
-				auto end = topic.find('%', begin + 1);
-				if (end == string::npos)
-				{
-					newTopics.insert(topic);
-					break;
-				}
-
-				auto& item = items.get(topic.substr(begin + 1, end - begin - 1));
-				const Value& value = item.getLastValue();
-				if (value.isString())
-					topic.replace(begin, end - begin + 1, value.getString());
-				else if (value.isNumber())
-					topic.replace(begin, end - begin + 1, cnvToStr(value.getNumber()));
-				else
-				{
-					logger.warn() << "No STRING or NUMBER value available to complete topic " << topic << " for item " << itemId << endOfMsg();
-					break;
-				}
-
-				curr = end + 1;
-			}
-		}
-		topics = newTopics;
-
 		// determine payload
-		string payload;
+		SharedString payload;
 		if (event.getType() != EventType::READ_REQ)
 		{
 			if (!event.getValue().isString())
@@ -546,31 +865,117 @@ void Handler::sendX(const Items& items, const Events& events)
 				logger.error() << "Event value type is not STRING for item " << itemId << endOfMsg();
 				continue;
 			}
-			payload = event.getValue().getString();
+			payload = event.getValue().getSharedString();
 		}
 
 		// send message
-		for (const auto& topic : topics)
-			sendMsg(topic, payload, event.getType() == EventType::STATE_IND ? config.getRetainFlag() : false);
+		for (auto& pubTopic : topicsPos->second)
+			if (const string* topic = pubTopic.render(items); topic)
+				sendMsg(*topic, payload, event.getType() == EventType::STATE_IND ? config.getRetainFlag() : false);
+			else
+				logger.warn() << "No STRING or NUMBER value available to complete topic " << pubTopic.getTopicStr() << " for item " << itemId << endOfMsg();
 	}
 
-	if (state == CONNECTED)
+	if (state == CONNECTED && !config.getThreadedLoop())
 	{
 		int ec = mosquitto_loop(client, 0, 1);
 		handleError("mosquitto_loop#2", ec);
 	}
 }
 
-void Handler::sendMessage(const string& topic, const string& payload, bool retainFlag)
+void Handler::sendMessage(const Msg& msg)
 {
-	lastMsgSendTime = std::time(0);
+	std::time_t now = std::time(0);
+	lastMsgSendTime = now;
+
+	// discard queued messages which are outdated
+	int expiryInterval = config.getMsgExpiryInterval();
+	if (expiryInterval)
+	{
+		expiryInterval -= now - msg.time;
+		if (expiryInterval <= 0)
+		{
+			if (config.getLogMsgs())
+				logger.debug() << "Message for topic " << msg.topic << " expired" << endOfMsg();
+			return;
+		}
+	}
 
 	if (config.getLogMsgs())
-		logger.debug() << "S " << topic << ": " << payload << endOfMsg();
+		logger.debug() << "S " << msg.topic << ": " << msg.payload << endOfMsg();
+
+	if (!config.getMqtt5())
+	{
+		int ec = mosquitto_publish(client, 0, msg.topic.c_str(), msg.payload.get().length(),
+			reinterpret_cast<const uint8_t*>(msg.payload.get().data()), 0, msg.retainFlag);
+		handleError("mosquitto_publish", ec);
+		return;
+	}
+
+	mosquitto_property* props = nullptr;
+	auto autoFree = finally([&props] { mosquitto_property_free_all(&props); });
+	if (expiryInterval)
+	{
+		int ec = mosquitto_property_add_int32(&props, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, expiryInterval);
+		handleError("mosquitto_property_add_int32", ec);
+	}
+
+	// the topic is omitted once the broker knows the alias
+	bool newAlias;
+	int alias = getTopicAlias(msg.topic, newAlias);
+	if (alias)
+	{
+		int ec = mosquitto_property_add_int16(&props, MQTT_PROP_TOPIC_ALIAS, alias);
+		handleError("mosquitto_property_add_int16", ec);
+	}
+
+	int ec = mosquitto_publish_v5(client, 0, alias && !newAlias ? nullptr : msg.topic.c_str(), msg.payload.get().length(),
+		reinterpret_cast<const uint8_t*>(msg.payload.get().data()), 0, msg.retainFlag, props);
+	handleError("mosquitto_publish_v5", ec);
+}
+
+int Handler::getTopicAlias(const string& topic, bool& newAlias)
+{
+	newAlias = false;
+
+	// limit memory in case of many different topics
+	if (topicStats.size() > 10000)
+		for (auto pos = topicStats.begin(); pos != topicStats.end();)
+			if (pos->second.alias)
+				pos++;
+			else
+				pos = topicStats.erase(pos);
+
+	TopicStats& stats = topicStats[topic];
+	stats.count++;
+	if (stats.alias || stats.count < 2)
+		return stats.alias;
+
+	// assign a free alias or take over the one of the least used topic in case this topic is
+	// used much more often
+	if (aliasTopics.size() < topicAliasMax)
+	{
+		aliasTopics.push_back(topic);
+		stats.alias = aliasTopics.size();
+	}
+	else if (aliasTopics.size())
+	{
+		int coldestAlias = 0;
+		for (int alias = 1; alias <= aliasTopics.size(); alias++)
+			if (!coldestAlias || topicStats[aliasTopics[alias - 1]].count < topicStats[aliasTopics[coldestAlias - 1]].count)
+				coldestAlias = alias;
+		TopicStats& coldestStats = topicStats[aliasTopics[coldestAlias - 1]];
+		if (stats.count < 2 * coldestStats.count)
+			return 0;
+		coldestStats.alias = 0;
+		aliasTopics[coldestAlias - 1] = topic;
+		stats.alias = coldestAlias;
+	}
+	else
+		return 0;
 
-	int ec = mosquitto_publish(client, 0, topic.c_str(), payload.length(),
-		reinterpret_cast<const uint8_t*>(payload.data()), 0, retainFlag);
-	handleError("mosquitto_publish", ec);
+	newAlias = true;
+	return stats.alias;
 }
 
 }
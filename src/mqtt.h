@@ -4,11 +4,17 @@
 #include <ctime>
 #include <unordered_set>
 #include <regex>
+#include <map>
+#include <memory>
+#include <string_view>
+#include <atomic>
+#include <thread>
 
 #include <mosquitto.h>
 
 #include "link.h"
 #include "logger.h"
+#include "spscqueue.h"
 
 namespace mqtt
 {
@@ -42,6 +48,37 @@ public:
 	static TopicPattern fromStr(const string& topicPatternStr);
 };
 
+// Topic for publishing which may contain %<item id>% placeholders. These are replaced by the
+// current value of the respective item. The rendered topic is cached until one of these values
+// changes.
+class PubTopic
+{
+private:
+	struct Segment
+	{
+		string text; // literal text or item id
+		bool isItemId;
+		Segment(string text, bool isItemId) : text(text), isItemId(isItemId) {}
+	};
+	string topicStr;
+	std::vector<Segment> segments;
+
+	// Values of the referenced items used for the last rendering.
+	std::vector<Value> values;
+	string topic;
+	bool rendered;
+
+public:
+	explicit PubTopic(const string& topicStr);
+
+	const string& getTopicStr() const { return topicStr; }
+
+	// Returns the topic for the current values of the referenced items or nullptr in case one of
+	// these values is neither STRING nor NUMBER.
+	const string* render(const Items& items);
+};
+typedef std::vector<PubTopic> PubTopics;
+
 class Config
 {
 public:
@@ -54,8 +91,9 @@ public:
 		string writeTopic;
 		string readTopic;
 		std::regex msgPattern;
-		Binding(string itemId, Topics stateTopics, string writeTopic, string readTopic, std::regex msgPattern) :
-			itemId(itemId), stateTopics(stateTopics), writeTopic(writeTopic), readTopic(readTopic), msgPattern(msgPattern)
+		bool anyMsg; // msgPattern is the default one and does not need to be evaluated
+		Binding(string itemId, Topics stateTopics, string writeTopic, string readTopic, std::regex msgPattern, bool anyMsg) :
+			itemId(itemId), stateTopics(stateTopics), writeTopic(writeTopic), readTopic(readTopic), msgPattern(msgPattern), anyMsg(anyMsg)
 		{}
 	};
 	class Bindings: public std::unordered_map<string, Binding>
@@ -65,6 +103,13 @@ public:
 		bool exists(const string& itemId) const { return find(itemId) != end(); }
 	};
 
+	// Message discarded when the queue of messages waiting for the connection is full.
+	enum DropPolicy
+	{
+		DROP_OLDEST,
+		DROP_NEWEST
+	};
+
 private:
 	string clientId;
 	string hostname;
@@ -75,6 +120,9 @@ private:
 	string ciphers;
 	int reconnectInterval;
 	int idleTimeout;
+	int maxQueuedMsgs;
+	DropPolicy dropPolicy;
+	int flushBatchSize;
 	string username;
 	string password;
 	bool retainFlag;
@@ -87,21 +135,30 @@ private:
 	Topics subTopics;
 	bool logMsgs;
 	bool logLibEvents;
+	bool threadedLoop;
+	bool mqtt5;
+	int msgExpiryInterval;
+	bool warmStart;
+	int warmStartTimeout;
 	Bindings bindings;
 
 public:
 	Config(string clientId, string hostname, int port, bool tlsFlag, string caFile, string caPath, string ciphers,
-		int reconnectInterval, int idleTimeout, string username, string password, bool retainFlag,
+		int reconnectInterval, int idleTimeout, int maxQueuedMsgs, DropPolicy dropPolicy, int flushBatchSize, string username, string password, bool retainFlag,
 		TopicPattern inStateTopicPattern, TopicPattern inWriteTopicPattern, TopicPattern inReadTopicPattern,
 		TopicPattern outStateTopicPattern, TopicPattern outWriteTopicPattern, TopicPattern outReadTopicPattern,
-		Topics subTopics, bool logMsgs, bool logLibEvents, Bindings bindings) :
+		Topics subTopics, bool logMsgs, bool logLibEvents, bool threadedLoop,
+		bool mqtt5, int msgExpiryInterval, bool warmStart, int warmStartTimeout, Bindings bindings) :
 		clientId(clientId), hostname(hostname), port(port),
 		tlsFlag(tlsFlag), caFile(caFile), caPath(caPath), ciphers(ciphers),
 		reconnectInterval(reconnectInterval), idleTimeout(idleTimeout),
+		maxQueuedMsgs(maxQueuedMsgs), dropPolicy(dropPolicy), flushBatchSize(flushBatchSize),
 		username(username), password(password), retainFlag(retainFlag),
 		inStateTopicPattern(inStateTopicPattern), inWriteTopicPattern(inWriteTopicPattern), inReadTopicPattern(inReadTopicPattern),
 		outStateTopicPattern(outStateTopicPattern), outWriteTopicPattern(outWriteTopicPattern), outReadTopicPattern(outReadTopicPattern),
-		subTopics(subTopics), logMsgs(logMsgs), logLibEvents(logLibEvents), bindings(bindings)
+		subTopics(subTopics), logMsgs(logMsgs), logLibEvents(logLibEvents), threadedLoop(threadedLoop),
+		mqtt5(mqtt5), msgExpiryInterval(msgExpiryInterval),
+		warmStart(warmStart), warmStartTimeout(warmStartTimeout), bindings(bindings)
 	{}
 	string getClientId() const { return clientId; }
 	string getHostname() const { return hostname; }
@@ -112,6 +169,9 @@ public:
 	string getCiphers() const { return ciphers; }
 	int getReconnectInterval() const { return reconnectInterval; }
 	int getIdleTimeout() const { return idleTimeout; }
+	int getMaxQueuedMsgs() const { return maxQueuedMsgs; }
+	DropPolicy getDropPolicy() const { return dropPolicy; }
+	int getFlushBatchSize() const { return flushBatchSize; }
 	string getUsername() const { return username; }
 	string getPassword() const { return password; }
 	bool getRetainFlag() const { return retainFlag; }
@@ -124,9 +184,94 @@ public:
 	const Topics& getSubTopics() const {return subTopics; }
 	bool getLogMsgs() const {return logMsgs; }
 	bool getLogLibEvents() const { return logLibEvents; }
+	bool getThreadedLoop() const { return threadedLoop; }
+	bool getMqtt5() const { return mqtt5; }
+	int getMsgExpiryInterval() const { return msgExpiryInterval; }
+	bool getWarmStart() const { return warmStart; }
+	int getWarmStartTimeout() const { return warmStartTimeout; }
 	const Bindings& getBindings() const { return bindings; }
 };
 
+// Tree of MQTT topic filters (possibly containing + and #) with one node per topic level. It
+// determines the subscribers of all filters matching a topic with effort proportional to the
+// number of topic levels.
+class TopicTree
+{
+public:
+	enum TopicType
+	{
+		STATE_TOPIC,
+		READ_TOPIC,
+		WRITE_TOPIC
+	};
+	struct Subscriber
+	{
+		const Config::Binding* binding;
+		TopicType topicType;
+		Subscriber(const Config::Binding* binding, TopicType topicType) : binding(binding), topicType(topicType) {}
+	};
+	using Subscribers = std::vector<Subscriber>;
+
+private:
+	struct Node
+	{
+		std::map<string, std::unique_ptr<Node>, std::less<>> children;
+		Subscribers subscribers;
+	};
+	Node root;
+
+	void collect(const Node& node, std::string_view topic, bool firstLevel, Subscribers& subscribers) const;
+
+public:
+	void add(const string& topicFilter, Subscriber subscriber);
+
+	// Appends the subscribers of all filters matching the passed topic.
+	void match(const string& topic, Subscribers& subscribers) const;
+
+	// Returns the topic filter without the prefix $share/<group>/ of a shared subscription.
+	static string getFilter(const string& topicFilter);
+};
+
+struct Msg 
+{
+	string topic;
+	SharedString payload;
+	bool retainFlag;
+	std::time_t time; // creation time
+	Msg() : retainFlag(false), time(0) {}
+	Msg(const string& topic, SharedString payload, bool retainFlag) :
+		topic(topic), payload(std::move(payload)), retainFlag(retainFlag), time(std::time(0)) {
+	}
+};
+
+// Bounded queue of messages waiting to be published. A retained message replaces a queued
+// retained message for the same topic, all other messages keep their order.
+class MsgQueue
+{
+private:
+	std::list<Msg> msgs;
+
+	// Queued retained messages by topic.
+	std::unordered_map<string, std::list<Msg>::iterator> retainedMsgs;
+
+	int maxSize;
+	Config::DropPolicy dropPolicy;
+
+	// Number of messages discarded since the queue was full.
+	int droppedMsgs;
+
+public:
+	MsgQueue(int maxSize, Config::DropPolicy dropPolicy) : maxSize(maxSize), dropPolicy(dropPolicy), droppedMsgs(0) {}
+
+	int size() const { return msgs.size(); }
+	bool empty() const { return msgs.empty(); }
+	int getDroppedMsgs() const { return droppedMsgs; }
+
+	void push(const Msg& msg);
+	const Msg& front() const { return msgs.front(); }
+	void pop();
+};
+
 class Handler: public HandlerIf
 {
 private:
@@ -145,17 +290,49 @@ private:
 	struct mosquitto* client;
 	std::time_t lastConnectTry;
 	std::time_t lastMsgSendTime;
-	struct Msg 
+	std::list<Msg> receivedMsgs;
+
+	// In case of threaded loop: Received messages and library log events which are handed
+	// over from the network thread. The eventfd signals their arrival to the main loop.
+	std::thread::id mainThreadId;
+	int eventFd;
+	SpscQueue<Msg> threadMsgs;
+	SpscQueue<string> threadLogs;
+
+	// Result of the last CONNACK (-1 if none) and indication of a lost connection. Both may be set
+	// by the network thread.
+	std::atomic<int> connectRc;
+	std::atomic<bool> connectionLost;
+
+	// MQTT 5: Maximum number of topic aliases accepted by the broker (from CONNACK).
+	std::atomic<int> topicAliasMax;
+
+	// MQTT 5: Number of publications per topic and alias assigned to it (0 if none) on the
+	// current connection. The most frequently used topics get an alias.
+	struct TopicStats
 	{
-		string topic;
-		string payload;
-		bool retainFlag;
-		Msg(const string& topic, const string& payload, bool retainFlag) :
-			topic(topic), payload(payload), retainFlag(retainFlag) {
-		}
+		unsigned count = 0;
+		int alias = 0;
 	};
-	std::list<Msg> receivedMsgs;
-	std::list<Msg> waitingMsgs;
+	std::unordered_map<string, TopicStats> topicStats;
+	std::vector<string> aliasTopics; // topic per alias - 1
+
+	// Warm start: Retained messages received after the first connect are collected as snapshot
+	// until all subscriptions have been acknowledged and no further retained message arrives.
+	bool warmStarting;
+	std::atomic<int> pendingSubAcks;
+	std::time_t warmStartBegin;
+	Stopwatch lastRetainedMsg;
+	Events snapshot;
+
+	// Messages waiting for the (re)connection to the broker.
+	MsgQueue waitingMsgs;
+
+	// Topics of all bindings.
+	TopicTree topicTree;
+
+	// Publish topics per event type (STATE_IND, WRITE_REQ and READ_REQ) and item.
+	std::unordered_map<string, PubTopics> pubTopics[3];
 
 	// External state of handler.
 	HandlerState handlerState;
@@ -168,6 +345,7 @@ public:
 	virtual long collectFds(fd_set* readFds, fd_set* writeFds, fd_set* excpFds, int* maxFd) override;
 	virtual Events receive(const Items& items) override;
 	virtual Events send(const Items& items, const Events& events) override;
+	virtual Events takeSnapshot() override;
 
 private:
 	void disconnect();
@@ -176,10 +354,19 @@ private:
 	void handleError(const string& funcName, int errorCode);
 	void onLog(int level, const string& text);
 	void onConnect(int rc);
-	void onMessage(const Msg& msg);
-	void sendMessage(const string& topic, const string& payload, bool retainFlag);
+	void onDisconnect(int rc);
+	void onMessage(Msg&& msg);
+	void onSubscribe();
+	void notifyMainLoop();
+	void subscribe(const string& topic);
+	void receiveThreadData();
+	void sendMessage(const Msg& msg);
+	int getTopicAlias(const string& topic, bool& newAlias);
 
 	friend void onConnect(struct mosquitto*, void*, int);
+	friend void onConnectV5(struct mosquitto*, void*, int, int, const mosquitto_property*);
+	friend void onDisconnect(struct mosquitto*, void*, int);
+	friend void onSubscribe(struct mosquitto*, void*, int, int, const int*);
 	friend void onMessage(struct mosquitto*, void*, const struct mosquitto_message*);
 	friend void onLog(struct mosquitto*, void*, int, const char*);
 };
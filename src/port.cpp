@@ -39,6 +39,112 @@ bool PortConfig::isValidParity(string parityStr, Parity& parity)
 	return true;
 }
 
+void setupSerialPort(int fd, int baudRate, int dataBits, int stopBits, PortConfig::Parity parity, struct termios& oldSettings)
+{
+	// get current port settings
+	memset(&oldSettings, 0, sizeof(oldSettings));
+	if (tcgetattr(fd, &oldSettings) != 0)
+		Error() << unixError("tcgetattr") << endOfMsg();
+
+	// create new port settings
+	struct termios settings;
+	memset(&settings, 0, sizeof(settings));
+
+	// enable raw mode - special processing of characters is disabled
+	cfmakeraw(&settings);
+
+	// set baud rate
+	speed_t speed;
+	switch (baudRate)
+	{
+		case 1200:
+			speed = B1200; break;
+		case 1800:
+			speed = B1800; break;
+		case 2400:
+			speed = B2400; break;
+		case 4800:
+			speed = B4800; break;
+		case 9600:
+			speed = B9600; break;
+		case 19200:
+			speed = B19200; break;
+		case 38400:
+			speed = B38400; break;
+		case 57600:
+			speed = B57600; break;
+		case 115200:
+			speed = B115200; break;
+		default:
+			assert(false && "invalid baud rate");
+	}
+	cfsetospeed(&settings, speed);
+	cfsetispeed(&settings, speed);
+
+	// set parity
+	switch (parity)
+	{
+		case PortConfig::NONE:
+			settings.c_cflag &= ~PARENB;
+			break;
+		case PortConfig::ODD:
+			settings.c_cflag |= PARENB;
+			settings.c_cflag |= PARODD;
+			break;
+		case PortConfig::EVEN:
+			settings.c_cflag |= PARENB;
+			settings.c_cflag &= ~PARODD;
+			break;
+		default:
+			assert(false && "invalid parity");
+	}
+
+	// set data bits
+	tcflag_t cs;
+	switch (dataBits)
+	{
+		case 5:
+			cs = CS5; break;
+		case 6:
+			cs = CS6; break;
+		case 7:
+			cs = CS7; break;
+		case 8:
+			cs = CS8; break;
+		default:
+			assert(false && "invalid data bits");
+	}
+	settings.c_cflag &= ~CSIZE;
+	settings.c_cflag |= cs;
+
+	// set stop bits
+	switch (stopBits)
+	{
+		case 1:
+			settings.c_cflag &= ~CSTOPB; break;
+		case 2:
+			settings.c_cflag |= CSTOPB; break;
+		default:
+			assert(false && "invalid stop bits");
+	}
+
+	// enable the receiver and set local mode
+	settings.c_cflag |= (CLOCAL | CREAD);
+
+	// ignore parity errors
+	//settings.c_iflag |= IGNPAR;
+
+	// enable canonical mode
+	//settings.c_lflag |= ICANON;
+
+	// generate signals
+	//settings.c_lflag |= ISIG;
+
+	// enable new settings
+	if (tcsetattr(fd, TCSANOW, &settings) != 0)
+		Error() << unixError("tcsetattr") << endOfMsg();
+}
+
 PortHandler::PortHandler(string _id, PortConfig _config, Logger _logger) : 
 	id(_id), config(_config), logger(_logger), fd(-1), lastOpenTry(0), lastDataReceipt(0)
 {
@@ -98,108 +204,7 @@ bool PortHandler::open()
 			logger.errorX() << unixError("open") << endOfMsg();
 		auto autoClose = finally([this] { ::close(fd); fd = -1; });
 
-		// get current port settings
-		memset(&oldSettings, 0, sizeof(oldSettings));
-		if (tcgetattr(fd, &oldSettings) != 0)
-			logger.errorX() << unixError("tcgetattr") << endOfMsg();
-
-		// create new port settings
-		struct termios settings;
-		memset(&settings, 0, sizeof(settings));
-	
-		// enable raw mode - special processing of characters is disabled
-		cfmakeraw(&settings);
-
-		// set baud rate
-		speed_t speed;
-		switch (config.getBaudRate())
-		{
-			case 1200:
-				speed = B1200; break;
-			case 1800:
-				speed = B1800; break;
-			case 2400:
-				speed = B2400; break;
-			case 4800:
-				speed = B4800; break;
-			case 9600:
-				speed = B9600; break;
-			case 19200:
-				speed = B19200; break;
-			case 38400:
-				speed = B38400; break;
-			case 57600:
-				speed = B57600; break;
-			case 115200:
-				speed = B115200; break;
-			default:
-				assert(false && "invalid baud rate");
-		}
-		cfsetospeed(&settings, speed);
-		cfsetispeed(&settings, speed);
-
-		// set parity
-		switch (config.getParity())
-		{
-			case PortConfig::NONE:
-				settings.c_cflag &= ~PARENB;
-				break;
-			case PortConfig::ODD:
-				settings.c_cflag |= PARENB;
-				settings.c_cflag |= PARODD;
-				break;
-			case PortConfig::EVEN:
-				settings.c_cflag |= PARENB;
-				settings.c_cflag &= ~PARODD;
-				break;
-			default:
-				assert(false && "invalid parity");
-		}
-
-		// set data bits
-		tcflag_t cs;
-		switch (config.getDataBits())
-		{
-			case 5:
-				cs = CS5; break;
-			case 6:
-				cs = CS6; break;
-			case 7:
-				cs = CS7; break;
-			case 8:
-				cs = CS8; break;
-			default:
-				assert(false && "invalid data bits");
-		}
-		settings.c_cflag &= ~CSIZE;
-		settings.c_cflag |= cs;
-
-		// set stop bits
-		switch (config.getStopBits())
-		{
-			case 1:
-				settings.c_cflag &= ~CSTOPB; break;
-			case 2:
-				settings.c_cflag |= CSTOPB; break;
-			default:
-				assert(false && "invalid stop bits");
-		}
-
-		// enable the receiver and set local mode
-		//settings.c_cflag |= (CLOCAL | CREAD);
-
-		// ignore parity errors
-		//settings.c_iflag |= IGNPAR;
-
-		// enable canonical mode
-		//settings.c_lflag |= ICANON;
-
-		// generate signals
-		//settings.c_lflag |= ISIG;
-
-		// enable new settings
-		if (tcsetattr(fd, TCSANOW, &settings) != 0)
-			logger.errorX() << unixError("tcsetattr") << endOfMsg();
+		setupSerialPort(fd, config.getBaudRate(), config.getDataBits(), config.getStopBits(), config.getParity(), oldSettings);
 
 		autoClose.disable();
 	}
@@ -227,6 +232,7 @@ void PortHandler::close()
 	lastOpenTry = 0;
 	lastDataReceipt = 0;
 	streamData.clear();
+	rawData.clear();
 
 	logger.info() << "Serial port " << config.getName() << " closed" << endOfMsg();
 	handlerState.operational = false;
@@ -234,39 +240,37 @@ void PortHandler::close()
 
 void PortHandler::receiveData()
 {
-	// receive data
-	string receivedData;
+	// receive all available data, bounded to keep other handlers responsive
+	StreamBuffer& buffer = config.getConvertToHex() ? rawData : streamData;
+	std::size_t receivedBytes;
 	if (config.getInputItemId() == "")
 	{
-		char buffer[256];
-		int rc = ::read(fd, buffer, sizeof(buffer));
-		if (rc < 0)
-			if (errno == EWOULDBLOCK || errno == EAGAIN)
-				return;
-			else
-				logger.errorX() << unixError("read") << endOfMsg();
-		if (rc == 0)
+		bool eof;
+		receivedBytes = buffer.readFrom(fd, eof);
+		if (eof && !receivedBytes)
 			logger.errorX() << "Data transmission stopped" << endOfMsg();
-		receivedData = string(buffer, rc);
 	}
 	else
 	{
-		receivedData = inputData;
+		buffer.append(inputData);
+		receivedBytes = inputData.length();
 		inputData.clear();
 	}
 
-	if (receivedData.length())
+	if (receivedBytes)
 	{
 		// hex handling?
 		if (config.getConvertToHex())
-			receivedData = cnvToHexStr(receivedData);
+		{
+			string hexData = cnvToHexStr(rawData.byteView());
+			rawData.clear();
+			receivedBytes = hexData.length();
+			streamData.append(hexData);
+		}
 
 		// trace received data
 		if (config.getLogRawData())
-			logger.debug() << "R " << receivedData << endOfMsg();
-
-		// append received data to overall data
-		streamData += receivedData;
+			logger.debug() << "R " << streamData.view().substr(streamData.size() - receivedBytes) << endOfMsg();
 
 		// remember time of data receipt
 		lastDataReceipt = std::time(0);
@@ -323,26 +327,30 @@ Events PortHandler::receiveX()
 	// read all available data
 	receiveData();
 
-	// analyze available data
-	std::smatch match;
-	while (std::regex_search(streamData, match, config.getMsgPattern()) && match.size() == 2)
+	// analyze available data in place
+	std::cmatch match;
+	std::smatch itemMatch;
+	std::string_view data = streamData.view();
+	while (std::regex_search(data.data(), data.data() + data.size(), match, config.getMsgPattern()) && match.size() == 2)
 	{
 		// complete message available
 		string msg = match[1];
 		string binMsg = cnvToBinStr(msg);
-		streamData = match.suffix();
+		auto msgEnd = match.position(0) + match.length(0);
+		streamData.consume(msgEnd);
+		data.remove_prefix(msgEnd);
 
 		// analyze message
 		for (auto& [itemId, binding] : config.getBindings())
-			if (  (binding.binMatching && std::regex_search(binMsg, match, binding.pattern) && match.size() == 2)
-			   || (!binding.binMatching && std::regex_search(msg, match, binding.pattern) && match.size() == 2)
+			if (  (binding.binMatching && std::regex_search(binMsg, itemMatch, binding.pattern) && itemMatch.size() == 2)
+			   || (!binding.binMatching && std::regex_search(msg, itemMatch, binding.pattern) && itemMatch.size() == 2)
 			   )
-				events.add(Event(id, itemId, EventType::STATE_IND, Value::newString(match[1])));
+				events.add(Event(id, itemId, EventType::STATE_IND, Value::newString(itemMatch[1])));
 	}
 
 	// detect wrong data
-	if (streamData.length() > 2 * config.getMaxMsgSize())
-		logger.errorX() << "Data " << streamData << " does not match message pattern" << endOfMsg();
+	if (streamData.size() > std::size_t(2 * config.getMaxMsgSize()))
+		logger.errorX() << "Data " << data << " does not match message pattern" << endOfMsg();
 
 	return events;
 }
@@ -8,6 +8,7 @@
 
 #include "link.h"
 #include "logger.h"
+#include "streambuffer.h"
 
 class PortConfig
 {
@@ -71,13 +72,19 @@ public:
 	static bool isValidParity(string parityStr, Parity& parity);
 };
 
+// Puts the serial port behind the file descriptor into raw mode with the given line settings. The
+// previous settings are stored in oldSettings. Throws an exception on failure.
+extern void setupSerialPort(int fd, int baudRate, int dataBits, int stopBits, PortConfig::Parity parity, struct termios& oldSettings);
+
 class PortHandler: public HandlerIf
 {
 private:
 	string id;
 	PortConfig config;
 	Logger logger;
-	string streamData;
+	// received data, raw data is only used when it is converted to hex
+	StreamBuffer streamData;
+	StreamBuffer rawData;
 	string inputData;
 	int fd;
 	std::time_t lastOpenTry;
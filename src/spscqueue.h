@@ -0,0 +1,51 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// Bounded lock-free queue for handing over objects from exactly one producer thread to exactly
+// one consumer thread. The capacity must be a power of 2.
+template<typename T>
+class SpscQueue
+{
+private:
+	std::vector<T> slots;
+	const std::size_t mask;
+
+	// Position of the next object to be taken by the consumer.
+	alignas(64) std::atomic<std::size_t> head;
+
+	// Position of the next object to be stored by the producer.
+	alignas(64) std::atomic<std::size_t> tail;
+
+public:
+	explicit SpscQueue(std::size_t capacity) : slots(capacity), mask(capacity - 1), head(0), tail(0) {}
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+	// Called by the producer. Returns false if the queue is full.
+	bool push(T&& value)
+	{
+		std::size_t pos = tail.load(std::memory_order_relaxed);
+		if (pos - head.load(std::memory_order_acquire) == slots.size())
+			return false;
+		slots[pos & mask] = std::move(value);
+		tail.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Called by the consumer. Returns false if the queue is empty.
+	bool pop(T& value)
+	{
+		std::size_t pos = head.load(std::memory_order_relaxed);
+		if (pos == tail.load(std::memory_order_acquire))
+			return false;
+		value = std::move(slots[pos & mask]);
+		head.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+};
+
+#endif
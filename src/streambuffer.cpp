@@ -0,0 +1,92 @@
+#include <sys/uio.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <cassert>
+
+#include "streambuffer.h"
+#include "logger.h"
+
+StreamBuffer::StreamBuffer(std::size_t capacity) :
+	buffer(1), head(0), length(0)
+{
+	while (buffer.size() < capacity)
+		buffer.resize(buffer.size() * 2);
+}
+
+void StreamBuffer::grow()
+{
+	std::vector<char> newBuffer(buffer.size() * 2);
+	auto data = view();
+	std::copy(data.begin(), data.end(), newBuffer.begin());
+	buffer.swap(newBuffer);
+	head = 0;
+}
+
+void StreamBuffer::append(std::string_view data)
+{
+	while (buffer.size() - length < data.size())
+		grow();
+	for (char c : data)
+		buffer[(head + length++) & mask()] = c;
+}
+
+std::size_t StreamBuffer::readFrom(int fd, bool& eof, std::size_t maxBytes)
+{
+	eof = false;
+	std::size_t totalBytes = 0;
+	while (totalBytes < maxBytes)
+	{
+		if (length == buffer.size())
+			grow();
+
+		// free space consists of up to two segments
+		std::size_t tail = (head + length) & mask();
+		std::size_t limit = maxBytes - totalBytes;
+		iovec iov[2];
+		int iovCount = 0;
+		if (tail >= head)
+		{
+			iov[iovCount++] = {&buffer[tail], std::min(buffer.size() - tail, limit)};
+			if (head > 0 && iov[0].iov_len < limit)
+				iov[iovCount++] = {&buffer[0], std::min(head, limit - iov[0].iov_len)};
+		}
+		else
+			iov[iovCount++] = {&buffer[tail], std::min(head - tail, limit)};
+
+		ssize_t rc = ::readv(fd, iov, iovCount);
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EWOULDBLOCK || errno == EAGAIN)
+				break;
+			Error() << unixError("readv") << endOfMsg();
+		}
+		if (rc == 0)
+		{
+			eof = true;
+			break;
+		}
+		length += rc;
+		totalBytes += rc;
+	}
+	return totalBytes;
+}
+
+std::string_view StreamBuffer::view()
+{
+	if (head + length > buffer.size())
+	{
+		std::rotate(buffer.begin(), buffer.begin() + head, buffer.end());
+		head = 0;
+	}
+	return std::string_view(buffer.data() + head, length);
+}
+
+void StreamBuffer::consume(std::size_t n)
+{
+	assert(n <= length);
+	length -= n;
+	head = length ? (head + n) & mask() : 0;
+}
@@ -0,0 +1,46 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <vector>
+
+#include "basic.h"
+
+// Growable ring buffer for byte streams. Data is read with readv() directly into the free space
+// and consumed in place by the parsers, so neither reading nor consuming moves buffered data.
+class StreamBuffer
+{
+private:
+	// Storage whose size is always a power of 2.
+	std::vector<char> buffer;
+
+	// Position of the first byte and number of buffered bytes.
+	std::size_t head;
+	std::size_t length;
+
+	std::size_t mask() const { return buffer.size() - 1; }
+	void grow();
+
+public:
+	explicit StreamBuffer(std::size_t capacity = 4096);
+
+	std::size_t size() const { return length; }
+	bool empty() const { return length == 0; }
+	void clear() { head = length = 0; }
+
+	void append(std::string_view data);
+
+	// Reads from the non-blocking file descriptor until no more data is available, the end of file is
+	// reached (eof is set) or maxBytes have been read. Returns the number of bytes read. Throws an
+	// exception on errors.
+	std::size_t readFrom(int fd, bool& eof, std::size_t maxBytes = 65536);
+
+	// Returns the buffered data as one contiguous block. The buffer is only rearranged if the data
+	// wraps around. The view remains valid until the next modification.
+	std::string_view view();
+	ByteView byteView() { auto data = view(); return ByteView(reinterpret_cast<const Byte*>(data.data()), data.size()); }
+
+	// Discards the first bytes.
+	void consume(std::size_t n);
+};
+
+#endif
@@ -9,7 +9,8 @@
 #include "tcp.h"
 
 TcpHandler::TcpHandler(string id, TcpConfig config, Logger logger) :
-	id(id), config(config), logger(logger), socket(-1), lastConnectTry(0), lastDataReceipt(0)
+	id(id), config(config), logger(logger), socket(-1),
+	connector(config.getHostname(), config.getPort(), config.getConnectTimeout()), lastConnectTry(0), lastDataReceipt(0)
 {
 	handlerState.errorCounter = 0;
 	handlerState.operational = false;
@@ -43,40 +44,23 @@ bool TcpHandler::open()
 	if (socket >= 0)
 		return true;
 
-	// shell we perform another attempt to connect to the remote site?
-	std::time_t now = std::time(0);
-	if (lastConnectTry + config.getReconnectInterval() > now)
+	if (!connector.isActive())
+	{
+		// shell we perform another attempt to connect to the remote site?
+		std::time_t now = std::time(0);
+		if (lastConnectTry + config.getReconnectInterval() > now)
+			return false;
+		lastConnectTry = now;
+		lastDataReceipt = now;
+
+		connector.start();
+	}
+
+	// connection attempt still in progress?
+	socket = connector.process();
+	if (socket < 0)
 		return false;
-	lastConnectTry = now;
-	lastDataReceipt = now;
-
-	addrinfo hints;
-	addrinfo* addrs;
-//	hints.ai_family = AF_UNSPEC;
-	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = IPPROTO_TCP;
-	hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
-	int rc = getaddrinfo(config.getHostname().c_str(), cnvToStr(config.getPort()).c_str(), &hints, &addrs);
-	if (rc != 0)
-		logger.errorX() << "Error " << rc << " (" << gai_strerror(rc) << ") occurred in function getaddrinfo" << endOfMsg();
-	auto autoFree = finally([addrs] { freeaddrinfo(addrs); });
-
-	socket = ::socket(AF_INET, SOCK_STREAM /*| SOCK_NONBLOCK*/, 0);
-	if (socket == -1)
-		logger.errorX() << unixError("socket") << endOfMsg();
-	auto autoClose = finally([this] { ::close(socket); socket = -1; });
-
-	if (connect(socket, addrs->ai_addr, addrs->ai_addrlen) == -1)
-		logger.errorX() << unixError("connect") << endOfMsg();
-
-	int flags = fcntl(socket, F_GETFL);
-	if (flags == -1)
-		logger.errorX() << unixError("fcntl") << endOfMsg();
-	if (fcntl(socket, F_SETFL, flags | O_NONBLOCK) == -1)
-		logger.errorX() << unixError("fcntl") << endOfMsg();
-
-	autoClose.disable();
+	lastDataReceipt = std::time(0);
 
 	logger.info() << "Connected to " << config.getHostname() << ":" << config.getPort() << endOfMsg();
 	handlerState.operational = true;
@@ -86,6 +70,8 @@ bool TcpHandler::open()
 
 void TcpHandler::close()
 {
+	connector.reset();
+
 	if (socket < 0)
 		return;
 
@@ -94,6 +80,7 @@ void TcpHandler::close()
 	lastConnectTry = 0;
 	lastDataReceipt = 0;
 	streamData.clear();
+	rawData.clear();
 
 	logger.info() << "Disconnected from " << config.getHostname() << ":" << config.getPort() << endOfMsg();
 	handlerState.operational = false;
@@ -101,6 +88,9 @@ void TcpHandler::close()
 
 long TcpHandler::collectFds(fd_set* readFds, fd_set* writeFds, fd_set* excpFds, int* maxFd)
 {
+	if (connector.isActive())
+		return connector.collectFds(writeFds, maxFd);
+
 	if (socket != -1)
 	{
 		FD_SET(socket, readFds);
@@ -144,61 +134,61 @@ Events TcpHandler::receiveX()
 	// read all available data
 	receiveData();
 
-	// analyze available data
-	std::smatch match;
-	while (std::regex_search(streamData, match, config.getMsgPattern()) && match.size() == 2)
+	// analyze available data in place
+	std::cmatch match;
+	std::smatch itemMatch;
+	std::string_view data = streamData.view();
+	while (std::regex_search(data.data(), data.data() + data.size(), match, config.getMsgPattern()) && match.size() == 2)
 	{
 		// complete message available
 		string msg = match[1];
 		string binMsg = cnvToBinStr(msg);
+		auto msgEnd = match.position(0) + match.length(0);
 
 		// process message
 		for (auto& [itemId, binding] : config.getBindings())
-			if (  (binding.binMatching && std::regex_search(binMsg, match, binding.pattern) && match.size() == 2)
-			   || (!binding.binMatching && std::regex_search(msg, match, binding.pattern) && match.size() == 2)
+			if (  (binding.binMatching && std::regex_search(binMsg, itemMatch, binding.pattern) && itemMatch.size() == 2)
+			   || (!binding.binMatching && std::regex_search(msg, itemMatch, binding.pattern) && itemMatch.size() == 2)
 			   )
-				events.add(Event(id, itemId, EventType::STATE_IND, Value::newString(match[1])));
+				events.add(Event(id, itemId, EventType::STATE_IND, Value::newString(itemMatch[1])));
 
 		// discard processed message
-		streamData = match.suffix();
+		streamData.consume(msgEnd);
+		data.remove_prefix(msgEnd);
 	}
 
 	// detect wrong data
-	if (streamData.length() > 2 * config.getMaxMsgSize())
-		logger.errorX() << "Data " << streamData << " does not match message pattern" << endOfMsg();
+	if (streamData.size() > std::size_t(2 * config.getMaxMsgSize()))
+		logger.errorX() << "Data " << data << " does not match message pattern" << endOfMsg();
 
 	return events;
 }
 
 void TcpHandler::receiveData()
 {
-	// receive data
-	char buffer[256];
-	int rc = ::read(socket, buffer, sizeof(buffer));
-	if (rc < 0)
-		if (errno == EWOULDBLOCK || errno == EAGAIN)
-			return;
-		else
-			logger.errorX() << unixError("read") << endOfMsg();
-	if (rc == 0)
+	// receive all available data, bounded to keep other handlers responsive
+	StreamBuffer& buffer = config.getConvertToHex() ? rawData : streamData;
+	bool eof;
+	std::size_t receivedBytes = buffer.readFrom(socket, eof);
+	if (eof && !receivedBytes)
 		logger.errorX() << "Disconnect by remote party" << endOfMsg();
-	string receivedData = string(buffer, rc);
 
-	if (receivedData.length())
+	if (receivedBytes)
 	{
 		// hex handling?
 		if (config.getConvertToHex())
-			receivedData = cnvToHexStr(receivedData);
+		{
+			string hexData = cnvToHexStr(rawData.byteView());
+			rawData.clear();
+			receivedBytes = hexData.length();
+			streamData.append(hexData);
+		}
 
 		// trace received data
 		if (config.getLogRawData())
-			logger.debug() << "R " << receivedData << endOfMsg();
-
-		// append received data to overall data
-		streamData += receivedData;
+			logger.debug() << "R " << streamData.view().substr(streamData.size() - receivedBytes) << endOfMsg();
 
 		// remember time of data receipt
 		lastDataReceipt = std::time(0);
 	}
 }
-
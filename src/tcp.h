@@ -5,6 +5,8 @@
 #include <ctime>
 
 #include "link.h"
+#include "connector.h"
+#include "streambuffer.h"
 #include "logger.h"
 
 class TcpConfig
@@ -29,6 +31,7 @@ private:
 	int port;
 	int timeoutInterval;
 	int reconnectInterval;
+	Seconds connectTimeout;
 	bool convertToHex;
 	std::regex msgPattern;
 	int maxMsgSize;
@@ -36,16 +39,17 @@ private:
 	Bindings bindings;
 
 public:
-	TcpConfig(string hostname, int port, int timeoutInterval, int reconnectInterval, bool convertToHex,
-		std::regex msgPattern, int maxMsgSize, bool logRawData, Bindings bindings) :
+	TcpConfig(string hostname, int port, int timeoutInterval, int reconnectInterval, Seconds connectTimeout,
+		bool convertToHex, std::regex msgPattern, int maxMsgSize, bool logRawData, Bindings bindings) :
 		hostname(hostname), port(port), timeoutInterval(timeoutInterval),
-		reconnectInterval(reconnectInterval), convertToHex(convertToHex), msgPattern(msgPattern),
+		reconnectInterval(reconnectInterval), connectTimeout(connectTimeout), convertToHex(convertToHex), msgPattern(msgPattern),
 		maxMsgSize(maxMsgSize), logRawData(logRawData), bindings(bindings)
 	{}
 	string getHostname() const { return hostname; }
 	int getPort() const { return port; }
 	int getTimeoutInterval() const { return timeoutInterval; }
 	int getReconnectInterval() const { return reconnectInterval; }
+	Seconds getConnectTimeout() const { return connectTimeout; }
 	bool getConvertToHex() const { return convertToHex; }
 	const std::regex& getMsgPattern() const { return msgPattern; }
 	int getMaxMsgSize() const { return maxMsgSize; }
@@ -59,8 +63,11 @@ private:
 	string id;
 	TcpConfig config;
 	Logger logger;
-	string streamData;
+	// received data, raw data is only used when it is converted to hex
+	StreamBuffer streamData;
+	StreamBuffer rawData;
 	int socket;
+	TcpConnector connector;
 	std::time_t lastConnectTry;
 	std::time_t lastDataReceipt;
 	HandlerState handlerState;
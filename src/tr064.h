@@ -3,7 +3,7 @@
 
 #include "link.h"
 #include "logger.h"
-#include "knx.h"
+#include "udp.h"
 
 class Tr064Config
 {
@@ -39,7 +39,7 @@ private:
 	string id;
 	Tr064Config config;
 	Logger logger;
-	int socket;
+	UdpSocket socket;
 
 public:
 	Tr064(string _id, Tr064Config _config, Logger _logger);
@@ -51,7 +51,6 @@ public:
 
 private:
 	void sendMSearch();
-	bool receiveMsg(ByteString& msg, IpAddr& addr, IpPort& port);
 };
 
 #endif
@@ -0,0 +1,198 @@
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <cassert>
+
+#include "udp.h"
+#include "logger.h"
+#include "finally.h"
+
+string IpAddr::toStr() const
+{
+	in_addr addr;
+	addr.s_addr = htonl(value);
+	return inet_ntoa(addr);
+}
+
+bool IpAddr::fromStr(string ipStr, IpAddr& ip)
+{
+	ip = ntohl(inet_addr(ipStr.c_str()));
+	return ip != INADDR_NONE;
+}
+
+UdpSocket::UdpSocket() :
+	fd(-1), recvBuffer(batchSize * maxMsgSize), sendBuffer(batchSize * maxMsgSize), recvCount(0), recvPos(0), sendCount(0)
+{
+}
+
+void UdpSocket::open(IpPort localPort, bool reuseAddr)
+{
+	close();
+
+	fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if (fd == -1)
+		Error() << unixError("socket") << endOfMsg();
+	auto autoClose = finally([this] { close(); });
+
+	if (reuseAddr)
+	{
+		int flag = 1;
+		int rc = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+		if (rc == -1)
+			Error() << unixError("setsockopt(SO_REUSEADDR)") << endOfMsg();
+	}
+
+	sockaddr_in localAddr;
+	localAddr.sin_family = AF_INET;
+	localAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	localAddr.sin_port = htons(localPort);
+	int rc = ::bind(fd, reinterpret_cast<sockaddr*>(&localAddr), sizeof(localAddr));
+	if (rc == -1)
+		Error() << unixError("bind") << endOfMsg();
+
+	autoClose.disable();
+}
+
+void UdpSocket::close()
+{
+	if (fd != -1)
+		::close(fd);
+	fd = -1;
+	recvCount = 0;
+	recvPos = 0;
+	sendCount = 0;
+}
+
+IpPort UdpSocket::getLocalPort() const
+{
+	sockaddr_in localAddr;
+	socklen_t localAddrLen = sizeof(localAddr);
+	int rc = getsockname(fd, reinterpret_cast<sockaddr*>(&localAddr), &localAddrLen);
+	if (rc == -1)
+		Error() << unixError("getsockname") << endOfMsg();
+	return ntohs(localAddr.sin_port);
+}
+
+bool UdpSocket::receiveMsg(Msg& msg)
+{
+	if (recvPos == recvCount)
+	{
+		recvCount = 0;
+		recvPos = 0;
+
+		mmsghdr hdrs[batchSize];
+		iovec iovs[batchSize];
+		sockaddr_in sockAddrs[batchSize];
+		for (int i = 0; i < batchSize; i++)
+		{
+			iovs[i].iov_base = &recvBuffer[i * maxMsgSize];
+			iovs[i].iov_len = maxMsgSize;
+			hdrs[i].msg_hdr.msg_name = &sockAddrs[i];
+			hdrs[i].msg_hdr.msg_namelen = sizeof(sockAddrs[i]);
+			hdrs[i].msg_hdr.msg_iov = &iovs[i];
+			hdrs[i].msg_hdr.msg_iovlen = 1;
+			hdrs[i].msg_hdr.msg_control = 0;
+			hdrs[i].msg_hdr.msg_controllen = 0;
+			hdrs[i].msg_hdr.msg_flags = 0;
+		}
+
+		int rc = ::recvmmsg(fd, hdrs, batchSize, 0, 0);
+		if (rc == -1)
+			if (errno == EWOULDBLOCK || errno == EAGAIN)
+				return false;
+			else
+				Error() << unixError("recvmmsg") << endOfMsg();
+
+		for (int i = 0; i < rc; i++)
+		{
+			if (hdrs[i].msg_hdr.msg_namelen != sizeof(sockAddrs[i]))
+				Error() << "Address returned by recvmmsg() has unexpected size" << endOfMsg();
+			if (sockAddrs[i].sin_family != AF_INET)
+				Error() << "Address returned by recvmmsg() does not belong to family AF_INET" << endOfMsg();
+			if (hdrs[i].msg_hdr.msg_flags & MSG_TRUNC)
+				Error() << "Message returned by recvmmsg() exceeds " << maxMsgSize << " bytes" << endOfMsg();
+
+			Msg& recvMsg = recvMsgs[i];
+			recvMsg.addr = IpAddr(ntohl(sockAddrs[i].sin_addr.s_addr));
+			recvMsg.port = ntohs(sockAddrs[i].sin_port);
+			recvMsg.data = &recvBuffer[i * maxMsgSize];
+			recvMsg.length = hdrs[i].msg_len;
+		}
+		recvCount = rc;
+	}
+
+	if (recvPos == recvCount)
+		return false;
+
+	msg = recvMsgs[recvPos++];
+	return true;
+}
+
+UdpSocket::Msg& UdpSocket::newMsg(IpAddr addr, IpPort port)
+{
+	assert(sendCount < batchSize);
+
+	Msg& msg = sendMsgs[sendCount];
+	msg.addr = addr;
+	msg.port = port;
+	msg.data = &sendBuffer[sendCount * maxMsgSize];
+	msg.length = 0;
+	sendCount++;
+	return msg;
+}
+
+void UdpSocket::flush()
+{
+	if (!sendCount)
+		return;
+	auto autoClear = finally([this] { sendCount = 0; });
+
+	mmsghdr hdrs[batchSize];
+	iovec iovs[batchSize];
+	sockaddr_in sockAddrs[batchSize];
+	for (int i = 0; i < sendCount; i++)
+	{
+		sockAddrs[i].sin_family = AF_INET;
+		sockAddrs[i].sin_addr.s_addr = htonl(sendMsgs[i].addr);
+		sockAddrs[i].sin_port = htons(sendMsgs[i].port);
+		iovs[i].iov_base = sendMsgs[i].data;
+		iovs[i].iov_len = sendMsgs[i].length;
+		hdrs[i].msg_hdr.msg_name = &sockAddrs[i];
+		hdrs[i].msg_hdr.msg_namelen = sizeof(sockAddrs[i]);
+		hdrs[i].msg_hdr.msg_iov = &iovs[i];
+		hdrs[i].msg_hdr.msg_iovlen = 1;
+		hdrs[i].msg_hdr.msg_control = 0;
+		hdrs[i].msg_hdr.msg_controllen = 0;
+		hdrs[i].msg_hdr.msg_flags = 0;
+	}
+
+	int sent = 0;
+	while (sent < sendCount)
+	{
+		int rc = ::sendmmsg(fd, hdrs + sent, sendCount - sent, 0);
+		if (rc == -1)
+			Error() << unixError("sendmmsg") << endOfMsg();
+		for (int i = sent; i < sent + rc; i++)
+			if (hdrs[i].msg_len != sendMsgs[i].length)
+				Error() << "Message size returned by sendmmsg() differs from the passed one" << endOfMsg();
+		sent += rc;
+	}
+}
+
+bool UdpSocket::waitForMsg(long timeoutMs) const
+{
+	fd_set readFds;
+	FD_ZERO(&readFds);
+	FD_SET(fd, &readFds);
+
+	timespec timeout;
+	timeout.tv_sec = timeoutMs / 1000;
+	timeout.tv_nsec = (timeoutMs % 1000) * 1000000;
+
+	int rc = pselect(fd + 1, &readFds, 0, 0, &timeout, 0);
+	if (rc == -1)
+		Error() << unixError("pselect") << endOfMsg();
+
+	return rc > 0;
+}
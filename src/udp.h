@@ -0,0 +1,95 @@
+#ifndef UDP_H
+#define UDP_H
+
+#include <vector>
+
+#include "basic.h"
+
+typedef unsigned short IpPort;
+
+struct IpAddr
+{
+	typedef unsigned long Value;
+	Value value;
+
+	IpAddr() : value(0) {}
+	IpAddr(Value _value) : value(_value) {}
+	IpAddr(Byte highHigh, Byte highLow, Byte lowHigh, Byte lowLow) : value(highHigh << 24 | highLow << 16 | lowHigh << 8 | lowLow) {}
+
+	Byte highHigh() const { return value >> 24 & 0xFF; }
+	Byte highLow() const { return value >> 16 & 0xFF; }
+	Byte lowHigh() const { return value >> 8 & 0xFF; }
+	Byte lowLow() const { return value & 0xFF; }
+
+	operator Value() const { return value; }
+	string toStr() const;
+	static bool fromStr(string ipStr, IpAddr& ip);
+};
+
+// Non-blocking UDP socket which receives and sends datagrams in batches (recvmmsg() and
+// sendmmsg()). All datagrams are kept in buffers which are allocated once at construction.
+class UdpSocket
+{
+public:
+	// Maximum size of a single datagram.
+	static const int maxMsgSize = 1024;
+
+	// Maximum number of datagrams received or sent with one system call.
+	static const int batchSize = 16;
+
+	struct Msg
+	{
+		IpAddr addr;
+		IpPort port;
+		Byte* data;
+		int length;
+		Msg() : port(0), data(0), length(0) {}
+	};
+
+private:
+	int fd;
+
+	// Buffers holding the datagrams of the current receive and send batch.
+	std::vector<Byte> recvBuffer;
+	std::vector<Byte> sendBuffer;
+
+	// Datagrams of the current receive batch. The ones before recvPos have already been
+	// passed to the caller.
+	Msg recvMsgs[batchSize];
+	int recvCount;
+	int recvPos;
+
+	// Datagrams which are queued for sending.
+	Msg sendMsgs[batchSize];
+	int sendCount;
+
+public:
+	UdpSocket();
+	UdpSocket(const UdpSocket&) = delete;
+	UdpSocket& operator=(const UdpSocket&) = delete;
+	~UdpSocket() { close(); }
+
+	void open(IpPort localPort = 0, bool reuseAddr = false);
+	void close();
+	bool isOpen() const { return fd != -1; }
+	int getFd() const { return fd; }
+	IpPort getLocalPort() const;
+
+	// Returns the next received datagram. The socket is drained batchwise and the returned data
+	// remains valid until the next call. Returns false if no more datagrams are available.
+	bool receiveMsg(Msg& msg);
+
+	// Queues a datagram for sending and returns it so that the caller can fill in data and length.
+	// The queue must be flushed once it is full.
+	Msg& newMsg(IpAddr addr, IpPort port);
+	bool isSendQueueFull() const { return sendCount == batchSize; }
+	int getQueuedMsgCount() const { return sendCount; }
+	const Msg& getQueuedMsg(int i) const { return sendMsgs[i]; }
+
+	// Sends all queued datagrams.
+	void flush();
+
+	bool waitForMsg(long timeoutMs) const;
+};
+
+#endif
@@ -49,7 +49,7 @@ private:
 
 public:
 	Unit() = default;
-	Unit(Code code) : code(code) {}
+	constexpr Unit(Code code) : code(code) {}
 
 	operator Code() const { return code; }
 	string toStr() const;
@@ -139,7 +139,7 @@ class Value
 {
 private:
 	ValueType type = ValueType::UNKNOWN;
-	string str;
+	SharedString str;
 	bool boolean = false;
 	Number number = 0.0;
 	Unit unit = Unit::UNKNOWN;
@@ -149,7 +149,7 @@ private:
 	Value(ValueType type, bool boolean) : type(type), boolean(boolean) {}
 	Value(ValueType type, Number number) : type(type), number(number) {}
 	Value(ValueType type, Number number, Unit unit) : type(type), number(number), unit(unit) {}
-	Value(ValueType type, string str) : type(type), str(str) {}
+	Value(ValueType type, SharedString str) : type(type), str(std::move(str)) {}
 	Value(ValueType type, TimePoint timePoint) : type(type), timePoint(timePoint) {}
 
 public:
@@ -157,7 +157,8 @@ public:
 
 	static Value newUndefined() { return Value(ValueType::UNDEFINED); }
 	static Value newVoid() { return Value(ValueType::VOID); }
-	static Value newString(string str) { return Value(ValueType::STRING, str); }
+	static Value newString(string str) { return Value(ValueType::STRING, SharedString(std::move(str))); }
+	static Value newString(SharedString str) { return Value(ValueType::STRING, std::move(str)); }
 	static Value newBoolean(bool boolean) { return Value(ValueType::BOOLEAN, boolean); }
 	static Value newNumber(Number number) { return Value(ValueType::NUMBER, number); }
 	static Value newNumber(Number number, Unit unit) { return Value(ValueType::NUMBER, number, unit); }
@@ -173,7 +174,8 @@ public:
 	bool isNumber() const { return type == ValueType::NUMBER; }
 	bool isTimePoint() const { return type == ValueType::TIME_POINT; }
 
-	const string& getString() const { assert(isString()); return str; }
+	const string& getString() const { assert(isString()); return str.get(); }
+	const SharedString& getSharedString() const { assert(isString()); return str; }
 	bool getBoolean() const { assert(isBoolean()); return boolean; }
 	Number getNumber() const { assert(isNumber()); return number; }
 	Number getNumber(Unit targetUnit) const { assert(isNumber()); return unit.convertTo(number, targetUnit); }